@@ -0,0 +1,129 @@
+#!/bin/bash
+
+# Measures how compile time, peak memory and object size grow with the number
+# of branches in a module, with and without the plugin. Each size is a
+# generated C file with that many if statements and switches spread over
+# functions of 1000 each. Set SQLITE_AMALGAMATION to a sqlite3.c to measure it
+# too. Results are written to compile-time.csv and the -time-passes report of
+# each instrumented compile, which has a section for every phase of the pass,
+# to compile-time.{name}.txt.
+#
+#   ./compile-time.sh {path to KeyPointsPass.so} [branch counts...]
+#
+# Exits with 1 if the pass takes more than twice as long per branch on the
+# largest module as on the smallest, which means something in it is
+# superlinear. CFLAGS (default -O0) and extra plugin options in KEYPOINTS_FLAGS
+# are passed to both compiles.
+
+requirements=(clang-15 /usr/bin/time)
+unmet=""
+for r in ${requirements[@]}; do
+    if [[ -z "$(which "$r")" ]]; then
+       unmet="$unmet $r"
+    fi
+done
+
+if [[ -n "$unmet" ]]; then
+    echo "Please install the following:$unmet"
+    exit 1
+fi
+
+if [[ -z "$1" ]]; then
+    echo "usage: $0 {path to KeyPointsPass.so} [branch counts...]"
+    exit 1
+fi
+
+PLUGIN=$(realpath "$1")
+SIZES=${@:2}
+if [[ -z "$SIZES" ]]; then
+    SIZES="1000 10000 100000 1000000"
+fi
+CFLAGS=${CFLAGS:-"-O0"}
+
+MLLVM=""
+for o in $KEYPOINTS_FLAGS; do
+    MLLVM="$MLLVM -mllvm $o"
+done
+
+OUTPUT="$(pwd)/compile-time.csv"
+pid=$$
+tmpdir="tmp-$pid"
+mkdir "$tmpdir"
+cd "$tmpdir"
+
+# generate {branches} {file}
+generate() {
+    awk -v n="$1" 'BEGIN {
+        emitted = 0
+        for (f = 0; emitted < n; f++) {
+            printf "int f%d(int x) {\n    int r = 0;\n", f
+            for (i = 0; i < 1000 && emitted < n; i++) {
+                emitted++
+                if (i % 10 == 9) {
+                    printf "    switch ((x + %d) & 7) {\n", i
+                    for (c = 0; c < 7; c++) {
+                        printf "    case %d:\n        r += %d;\n        break;\n", c, c + i
+                    }
+                    printf "    default:\n        r -= x;\n    }\n"
+                } else {
+                    printf "    if (x > %d) {\n        r += %d;\n    } else {\n        r -= %d;\n    }\n", i, i, i
+                }
+            }
+            printf "    return r;\n}\n"
+        }
+    }' > "$2"
+}
+
+# measure {source} {object} [compiler args...]: prints "seconds peak_rss_kb object_bytes"
+measure() {
+    local source=$1 object=$2
+    shift 2
+    if ! /usr/bin/time -f "%e %M" -o time.txt clang-15 -c $CFLAGS "$@" "$source" -o "$object" 2> compile.log; then
+        cat compile.log >&2
+        return 1
+    fi
+    echo "$(cat time.txt) $(stat -c %s "$object")"
+}
+
+echo "module,branches,tags,plain_seconds,plain_rss_kb,plain_object_bytes,instrumented_seconds,instrumented_rss_kb,instrumented_object_bytes,pass_seconds,pass_us_per_tag" > "$OUTPUT"
+
+# run {name} {source} {branches}
+first_rate=""
+last_rate=""
+run() {
+    local name=$1 source=$2 branches=$3
+    rm -f counter.log branch_dictionary.txt
+    plain=$(measure "$source" plain.o -gline-tables-only) || return 1
+    instrumented=$(measure "$source" instrumented.o -gline-tables-only -Xclang -load -Xclang "$PLUGIN" -fpass-plugin="$PLUGIN" $MLLVM -ftime-report) || return 1
+    cp compile.log "../compile-time.$name.txt"
+    local tags=$(wc -l < branch_dictionary.txt)
+    # the wall time column of the pass's line in the -time-passes report
+    local pass=$(sed 's/([^)]*)//g' compile.log | awk '/KeyPointsPass/ { print $4; exit }')
+    local rate=$(awk -v s="$pass" -v t="$tags" 'BEGIN { printf "%.3f", (t > 0 ? s * 1000000 / t : 0) }')
+    echo "$name,$branches,$tags,${plain// /,},${instrumented// /,},$pass,$rate" >> "$OUTPUT"
+    echo "$name: $tags tags, pass took ${pass}s, ${rate}us per tag"
+    if [[ "$name" == generated-* ]]; then
+        first_rate=${first_rate:-$rate}
+        last_rate=$rate
+    fi
+}
+
+failed=0
+for n in $SIZES; do
+    generate "$n" "generated-$n.c"
+    run "generated-$n" "generated-$n.c" "$n" || failed=1
+done
+
+if [[ -n "$SQLITE_AMALGAMATION" ]]; then
+    run sqlite3 "$(realpath "$SQLITE_AMALGAMATION")" "" || failed=1
+fi
+
+cd ..
+rm -rf "$tmpdir"
+
+if [[ -n "$first_rate" ]] && awk -v a="$first_rate" -v b="$last_rate" 'BEGIN { exit !(a > 0 && b > 2 * a) }'; then
+    echo "FAIL time per tag grew from ${first_rate}us to ${last_rate}us"
+    failed=1
+fi
+echo "results in $OUTPUT"
+exit $failed
@@ -0,0 +1,222 @@
+#!/bin/bash
+
+# Measures how much slower instrumented programs run than uninstrumented ones.
+# Every program in test-files/simple and test-files/realworld/fmt is built
+# without the plugin and in each mode below, and run RUNS times (default 5).
+# fmt is also given generated input of each size in lines; the simple programs
+# take no input and run once per repetition. For every program, mode and size
+# the median time, slowdown against the uninstrumented build, bytes of output
+# written per executed branch and peak memory are written to
+# runtime-overhead.csv and runtime-overhead.json.
+#
+#   ./runtime-overhead.sh {path to KeyPointsPass.so} [fmt input lines...]
+#
+# MODES picks a subset of the modes by name (the uninstrumented and trace builds
+# are always included), CFLAGS (default -O2) is used for every build.
+
+requirements=(clang-15 /usr/bin/time)
+unmet=""
+for r in ${requirements[@]}; do
+    if [[ -z "$(which "$r")" ]]; then
+       unmet="$unmet $r"
+    fi
+done
+
+if [[ -n "$unmet" ]]; then
+    echo "Please install the following:$unmet"
+    exit 1
+fi
+
+if [[ -z "$1" ]]; then
+    echo "usage: $0 {path to KeyPointsPass.so} [fmt input lines...]"
+    exit 1
+fi
+
+PLUGIN=$(realpath "$1")
+SIZES=${@:2}
+if [[ -z "$SIZES" ]]; then
+    SIZES="100 1000 10000"
+fi
+RUNS=${RUNS:-5}
+CFLAGS=${CFLAGS:-"-O2"}
+MODES=${MODES:-"trace trace-per-process trace-ring counter counter-promoted timing path"}
+# the baseline for the slowdowns and the trace that counts the executed
+# branches are always measured, first
+MODES=$(echo "plain trace $MODES" | awk '{ for (i = 1; i <= NF; i++) if (!seen[$i]++) printf "%s ", $i }')
+
+SCRIPT_DIR=$(realpath "$(dirname "$0")")
+TEST_FILES="$SCRIPT_DIR/../../test-files"
+RUNTIME="$SCRIPT_DIR/../support/branchlog.c"
+CSV="$(pwd)/runtime-overhead.csv"
+JSON="$(pwd)/runtime-overhead.json"
+
+# mode_flags {mode}: plugin options for the build, "none" to build without the plugin
+mode_flags() {
+    case $1 in
+        plain) echo none ;;
+        trace|trace-per-process|trace-ring) echo "" ;;
+        counter) echo "-keypoints-mode=counter" ;;
+        counter-promoted) echo "-keypoints-mode=counter -keypoints-branchless -keypoints-promote-counters" ;;
+        timing) echo "-keypoints-mode=timing" ;;
+        path) echo "-keypoints-mode=path" ;;
+    esac
+}
+
+# mode_env {mode}: runtime environment for the run
+mode_env() {
+    case $1 in
+        trace-per-process) echo "KEYPOINTS_PER_PROCESS=1" ;;
+        trace-ring) echo "KEYPOINTS_RING=1048576" ;;
+    esac
+}
+
+pid=$$
+tmpdir="tmp-$pid"
+mkdir "$tmpdir"
+cd "$tmpdir"
+WORK=$(pwd)
+
+# build {mode} {program} {sources...}
+build() {
+    local mode=$1 program=$2
+    shift 2
+    local flags=$(mode_flags "$mode")
+    local dir="$WORK/build/$mode/$program"
+    mkdir -p "$dir"
+    if [[ "$flags" == none ]]; then
+        (cd "$dir" && clang-15 $CFLAGS "$@" -o prog) || return 1
+        return
+    fi
+    local mllvm=""
+    for o in $flags; do
+        mllvm="$mllvm -mllvm $o"
+    done
+    # built in its own directory so every build gets fresh IDs and dictionary
+    (cd "$dir" && clang-15 $CFLAGS -gline-tables-only -Xclang -load -Xclang "$PLUGIN" -fpass-plugin="$PLUGIN" $mllvm -c "$@" &&
+        clang-15 $CFLAGS -c "$RUNTIME" -o branchlog.o && clang-15 *.o -o prog) || return 1
+}
+
+# generate_input {lines} {file}: paragraphs of words with ragged lines for fmt
+generate_input() {
+    awk -v n="$1" 'BEGIN {
+        split("the quick brown fox jumps over a lazy dog while branch traces grow without bound", words, " ")
+        srand(1)
+        for (i = 0; i < n; i++) {
+            if (i % 20 == 19) {
+                print ""
+                continue
+            }
+            line = ""
+            count = 1 + int(rand() * 15)
+            for (w = 0; w < count; w++) {
+                line = line (w ? " " : "") words[1 + int(rand() * 14)]
+            }
+            print line
+        }
+    }' > "$2"
+}
+
+# measure {mode} {program} {input or -}: prints "seconds peak_rss_kb output_bytes branches" for one run
+measure() {
+    local mode=$1 program=$2 input=$3
+    local run="$WORK/run"
+    rm -rf "$run"
+    mkdir "$run"
+    local start end
+    start=$(date +%s%N)
+    if [[ "$input" == - ]]; then
+        (cd "$run" && env $(mode_env "$mode") /usr/bin/time -f "%M" -o rss.txt "$WORK/build/$mode/$program/prog" > /dev/null 2>&1)
+    else
+        (cd "$run" && env $(mode_env "$mode") /usr/bin/time -f "%M" -o rss.txt "$WORK/build/$mode/$program/prog" < "$input" > /dev/null 2>&1)
+    fi
+    end=$(date +%s%N)
+    local bytes=0 branches=0
+    for f in "$run"/branch_*; do
+        [[ -e "$f" ]] || continue
+        bytes=$((bytes + $(stat -c %s "$f")))
+        if [[ "$f" == *branch_trace*.txt ]]; then
+            branches=$((branches + $(grep -c '^br_' "$f")))
+        fi
+    done
+    echo "$(awk -v s="$start" -v e="$end" 'BEGIN { printf "%.6f", (e - s) / 1e9 }') $(tail -n 1 "$run/rss.txt") $bytes $branches"
+}
+
+programs=()
+for f in "$TEST_FILES"/simple/*.c; do
+    name=$(basename "$f" .c)
+    # compiled along with externalcall.c
+    [[ "$name" == externalfunc ]] && continue
+    programs+=("$name")
+done
+programs+=(fmt)
+
+sources() {
+    case $1 in
+        externalcall) echo "$TEST_FILES/simple/externalcall.c $TEST_FILES/simple/externalfunc.c" ;;
+        fmt) echo "$TEST_FILES/realworld/fmt/fmt.c" ;;
+        *) echo "$TEST_FILES/simple/$1.c" ;;
+    esac
+}
+
+failed=0
+for mode in $MODES; do
+    for program in "${programs[@]}"; do
+        if ! build "$mode" "$program" $(sources "$program") 2> build.log; then
+            echo "FAIL building $program ($mode)"
+            cat build.log
+            failed=1
+        fi
+    done
+done
+
+for lines in $SIZES; do
+    generate_input "$lines" "$WORK/input-$lines.txt"
+done
+
+echo "program,mode,input_lines,runs,median_seconds,slowdown,branches,output_bytes,bytes_per_branch,peak_rss_kb" > "$CSV"
+for program in "${programs[@]}"; do
+    inputs="-"
+    if [[ "$program" == fmt ]]; then
+        inputs=$SIZES
+    fi
+    for lines in $inputs; do
+        input="-"
+        [[ "$lines" != - ]] && input="$WORK/input-$lines.txt"
+        baseline=""
+        # the trace run counts the branches the other modes execute too
+        branches=$(measure trace "$program" "$input" | awk '{ print $4 }')
+        for mode in $MODES; do
+            [[ -x "$WORK/build/$mode/$program/prog" ]] || continue
+            : > times.txt
+            for ((r = 0; r < RUNS; r++)); do
+                measure "$mode" "$program" "$input" >> times.txt
+            done
+            # median time; memory and output from the same run
+            read seconds rss bytes _ < <(sort -n times.txt | awk -v n="$RUNS" 'NR == int((n + 1) / 2)')
+            [[ "$mode" == plain ]] && baseline=$seconds
+            slowdown=$(awk -v s="$seconds" -v b="$baseline" 'BEGIN { printf "%.2f", (b > 0 ? s / b : 0) }')
+            per_branch=$(awk -v o="$bytes" -v b="$branches" 'BEGIN { printf "%.2f", (b > 0 ? o / b : 0) }')
+            echo "$program,$mode,${lines/-/},$RUNS,$seconds,$slowdown,$branches,$bytes,$per_branch,$rss" >> "$CSV"
+            label=$program
+            [[ "$lines" != - ]] && label="$program ($lines lines)"
+            echo "$label $mode: ${seconds}s, ${slowdown}x, $per_branch bytes per branch, ${rss}KB"
+        done
+    done
+done
+
+# the same rows as JSON
+awk -F, 'NR == 1 { for (i = 1; i <= NF; i++) key[i] = $i; printf "["; next }
+    {
+        printf "%s\n  {", (NR > 2 ? "," : "")
+        for (i = 1; i <= NF; i++) {
+            value = (i <= 3) ? "\"" $i "\"" : ($i == "" ? "null" : $i)
+            printf "%s\"%s\": %s", (i > 1 ? ", " : ""), key[i], value
+        }
+        printf "}"
+    }
+    END { print "\n]" }' "$CSV" > "$JSON"
+
+cd ..
+rm -rf "$tmpdir"
+echo "results in $CSV and $JSON"
+exit $failed
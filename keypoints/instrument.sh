@@ -27,6 +27,7 @@ fi
 cd ..
 
 cp "$tmpdir"/branch_dictionary.txt ./branch_dictionary.txt."$pid"
+cp "$tmpdir"/branch_sites.txt ./branch_sites.txt."$pid"
 cp "$tmpdir"/a.out ./a.out
 
 rm -rf "$tmpdir"
@@ -2,16 +2,128 @@
 #include "llvm/Pass.h"
 #include "llvm/Passes/PassBuilder.h"
 #include "llvm/Passes/PassPlugin.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/MapVector.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/ADT/StringSwitch.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/TargetLibraryInfo.h"
+#include "llvm/Config/abi-breaking.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/IR/DebugInfo.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/PassTimingInfo.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Timer.h"
 #include "llvm/Support/raw_ostream.h"
+#include "llvm/Support/xxhash.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/Transforms/Utils/ModuleUtils.h"
+#include "llvm/Transforms/Utils/SSAUpdater.h"
+#include "llvm/Transforms/Utils/ScalarEvolutionExpander.h"
 #include <string>
 #include <iostream>
 #include <fstream>
-#include <filesystem>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
 
 using namespace llvm;
 
+#define DEBUG_TYPE "keypoints"
+
+// reported by -stats; these are always enabled since release builds of LLVM,
+// which is what the plugin is normally loaded into, compile STATISTIC out
+ALWAYS_ENABLED_STATISTIC(NumTags, "Number of branch tags assigned");
+ALWAYS_ENABLED_STATISTIC(NumProbes, "Number of probes inserted");
+ALWAYS_ENABLED_STATISTIC(NumBranchless, "Number of tags counted with the branch condition");
+ALWAYS_ENABLED_STATISTIC(NumSplitEdges, "Number of critical edges split to hold a probe");
+ALWAYS_ENABLED_STATISTIC(NumHoisted, "Number of counters increased by a trip count before their loop");
+ALWAYS_ENABLED_STATISTIC(NumPromoted, "Number of counters kept in a register inside their loop");
+ALWAYS_ENABLED_STATISTIC(NumFunctionPointers, "Number of indirect calls logged");
+ALWAYS_ENABLED_STATISTIC(NumUnlocated, "Number of branches skipped for lack of a debug location");
+ALWAYS_ENABLED_STATISTIC(NumPruned, "Number of probes left out for tags an earlier run covered");
+ALWAYS_ENABLED_STATISTIC(NumCacheHits, "Number of modules whose IDs and dictionary came from the cache");
+
+// LLVM built without assertions prints "Statistics are disabled" for -stats
+// even for the ones above, so the pass prints them itself there
+static void printStatistics() {
+#if !LLVM_ENABLE_ABI_BREAKING_CHECKS && !LLVM_FORCE_ENABLE_STATS
+    if (!AreStatisticsEnabled()) {
+        return;
+    }
+    const TrackingStatistic *stats[] = {&NumTags, &NumProbes, &NumBranchless, &NumSplitEdges,
+        &NumHoisted, &NumPromoted, &NumFunctionPointers, &NumUnlocated, &NumPruned, &NumCacheHits};
+    errs() << "===-------------------------------------------------------------------------===\n"
+           << "                        KeyPoints statistics collected\n"
+           << "===-------------------------------------------------------------------------===\n";
+    for (auto stat : stats) {
+        if (stat->getValue() > 0) {
+            errs() << format("%8u %s - %s\n", stat->getValue(), stat->getDebugType(), stat->getDesc());
+        }
+    }
+#endif
+}
+
+// per-phase timers, reported along with the pass totals by -time-passes
+static const char *const TimerGroupName = "keypoints";
+static const char *const TimerGroupDescription = "KeyPoints pass phases";
+
 namespace {
 
+enum class Mode { Trace, Counter, Timing, Path };
+enum class EntryPoint { PipelineStart, OptimizerLast };
+
+// pass options are given to clang with -mllvm, e.g. -mllvm -keypoints-mode=counter
+cl::opt<Mode> KeyPointsMode("keypoints-mode", cl::desc("What the inserted probes record"),
+    cl::values(
+        clEnumValN(Mode::Trace, "trace", "append every executed branch tag to branch_trace.txt (default)"),
+        clEnumValN(Mode::Counter, "counter", "count executions per branch tag and dump the counts at exit"),
+        clEnumValN(Mode::Timing, "timing", "accumulate the cycles spent after each branch tag until the next one and dump them at exit"),
+        clEnumValN(Mode::Path, "path", "record the tags of each function invocation between calls as a path, storing each distinct path once")),
+    cl::init(Mode::Trace));
+cl::opt<EntryPoint> KeyPointsEntryPoint("keypoints-insertion-point", cl::desc("Where in the pipeline to insert probes"),
+    cl::values(
+        clEnumValN(EntryPoint::PipelineStart, "start", "before any optimization (default)"),
+        clEnumValN(EntryPoint::OptimizerLast, "optimizer-last", "after the optimizer, so probes don't block inlining, vectorization or CFG simplification")),
+    cl::init(EntryPoint::PipelineStart));
+cl::opt<bool> PromoteCounters("keypoints-promote-counters",
+    cl::desc("In counter mode, keep loop counters in registers and store them at loop exits"),
+    cl::init(false));
+cl::opt<bool> Branchless("keypoints-branchless",
+    cl::desc("In counter mode, count a branch's single-predecessor successors in the branching block using the condition"),
+    cl::init(false));
+cl::opt<std::string> CounterFile("keypoints-counter-file",
+    cl::desc("File holding the next free branch ID, shared by every module in a build"),
+    cl::init("counter.log"));
+cl::opt<std::string> DictionaryFile("keypoints-dictionary-file",
+    cl::desc("File the module's dictionary entries are appended to"),
+    cl::init("branch_dictionary.txt"));
+cl::opt<std::string> SitesFile("keypoints-sites-file",
+    cl::desc("File listing the tags of each branch and switch, appended to along with the dictionary"),
+    cl::init("branch_sites.txt"));
+cl::opt<std::string> StripPrefix("keypoints-strip-prefix",
+    cl::desc("Prefix to remove from module names in the dictionary, e.g. ../"));
+cl::opt<bool> StripDebug("keypoints-strip-debug",
+    cl::desc("Remove debug info once the dictionary is written, so -gline-tables-only builds produce objects like -g0"),
+    cl::init(false));
+cl::opt<std::string> PruneCounters("keypoints-prune-counters",
+    cl::desc("Counter dump of earlier runs; tags it shows were executed get no probe"),
+    cl::value_desc("path"));
+cl::opt<std::string> PruneDictionary("keypoints-prune-dictionary",
+    cl::desc("Dictionary the -keypoints-prune-counters dump was recorded against, whose IDs are kept"),
+    cl::value_desc("path"));
+cl::opt<std::string> CacheDir("keypoints-cache-dir",
+    cl::desc("Directory caching each module's IDs and dictionary entries by a hash of its IR, so unchanged modules keep them"),
+    cl::value_desc("path"));
+
 class BranchEntry {
     public: 
     const int id;
@@ -25,27 +137,371 @@ class BranchEntry {
         condition_line(condition_line), 
         block_start_line(block_start_line) 
     {}
-    friend std::ostream& operator <<(std::ostream &out, BranchEntry &BE);
+    friend raw_ostream& operator <<(raw_ostream &out, const BranchEntry &BE);
 };
 
-std::ostream& operator << (std::ostream &out, BranchEntry &BE) {
-    out << "br_" << BE.id << ": " << BE.file_name.str() << ", " << BE.condition_line << ", " << BE.block_start_line;
+raw_ostream& operator << (raw_ostream &out, const BranchEntry &BE) {
+    out << "br_" << BE.id << ": " << BE.file_name << ", " << BE.condition_line << ", " << BE.block_start_line;
     return out;
 }
 
-void writeBranchDictionary(std::vector<BranchEntry> &branchEntries) {
-    std::ofstream branch_dict("branch_dictionary.txt", std::ios_base::app);
-    for (auto BE : branchEntries) {
-        branch_dict << BE << std::endl;
+// FNV-1a over a single dictionary line. The dictionary hash is the sum of the
+// line hashes so modules can be combined in any order, both by the runtime and
+// by tools that recompute it from branch_dictionary.txt.
+uint64_t hashDictionaryLine(const std::string &line) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (unsigned char c : line) {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+std::string formatBranchDictionary(const std::vector<BranchEntry> &branchEntries) {
+    std::string contents;
+    raw_string_ostream out(contents);
+    for (const auto &BE : branchEntries) {
+        out << BE << "\n";
     }
-    branch_dict.close();
+    out.flush();
+    return contents;
 }
 
+// Appends `contents` to `path` with a single write. With `once`, nothing is
+// written if the file already holds them, as it does when a module whose IDs
+// came from the cache was compiled in the same directory before; repeating
+// them would throw off the summed dictionary hash.
+void appendEntries(const std::string &path, StringRef contents, bool once) {
+    if (contents.empty()) {
+        return;
+    }
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (fd < 0) {
+        report_fatal_error(Twine("unable to open ") + path);
+    }
+    // locked so a concurrent compile can't append the same entries in between
+    flock(fd, LOCK_EX);
+    bool present = false;
+    if (once) {
+        if (auto file = MemoryBuffer::getOpenFile(fd, path, -1, /*RequiresNullTerminator=*/false)) {
+            StringRef existing = (*file)->getBuffer();
+            auto at = existing.find(contents);
+            // only whole lines count, br_1: ... is not br_11: ...
+            present = at != StringRef::npos && (at == 0 || existing[at - 1] == '\n');
+        }
+    }
+    if (!present && write(fd, contents.data(), contents.size()) != (ssize_t)contents.size()) {
+        report_fatal_error(Twine("unable to write ") + path);
+    }
+    flock(fd, LOCK_UN);
+    close(fd);
+}
+
+uint64_t writeBranchDictionary(StringRef contents, bool once) {
+    uint64_t hash = 0;
+    SmallVector<StringRef, 64> lines;
+    contents.split(lines, '\n', -1, /*KeepEmpty=*/false);
+    for (auto line : lines) {
+        hash += hashDictionaryLine(line.str());
+    }
+    appendEntries(DictionaryFile, contents, once);
+    return hash;
+}
+
+// raw_ostream that hashes what is written to it instead of keeping it, so a
+// module can be hashed without holding its printed IR in memory. The text is
+// cut into fixed-size blocks and each block's xxHash is folded into the
+// running hash, so the result doesn't depend on how the writes were split.
+class HashStream : public raw_ostream {
+    public:
+    HashStream() { block.reserve(BlockSize); }
+    ~HashStream() override { flush(); }
+
+    uint64_t hash() {
+        flush();
+        fold();
+        return state;
+    }
+
+    private:
+    static constexpr size_t BlockSize = 64 * 1024;
+    std::string block;
+    uint64_t state = 0;
+    uint64_t written = 0;
+
+    void fold() {
+        uint64_t words[2] = {state, xxHash64(block)};
+        state = xxHash64(ArrayRef<uint8_t>(reinterpret_cast<const uint8_t *>(words), sizeof(words)));
+        block.clear();
+    }
+    void write_impl(const char *data, size_t size) override {
+        written += size;
+        while (size > 0) {
+            auto n = std::min(size, BlockSize - block.size());
+            block.append(data, n);
+            data += n;
+            size -= n;
+            if (block.size() == BlockSize) {
+                fold();
+            }
+        }
+    }
+    uint64_t current_pos() const override { return written; }
+};
+
+// Cache of each module's IDs and dictionary entries for -keypoints-cache-dir,
+// keyed by a hash of the module's IR before instrumentation and the plugin
+// options. A rebuild of an unchanged module gets the same IDs and entries
+// rather than new ones. The cache holds {key}.dict, the module's dictionary
+// entries, and {hash of module name}.module, the module's most recently used
+// keys. Several are kept so builds of the same sources with different flags or
+// modes sharing a cache don't evict each other; entries beyond that are
+// deleted. IDs come from the cache's own counter.log, so IDs in the cache are
+// never handed out again.
+class BuildCache {
+    public:
+    BuildCache(Module &M, StringRef moduleName) : moduleName(moduleName) {
+        if (sys::fs::create_directories(CacheDir)) {
+            report_fatal_error(Twine("unable to create ") + CacheDir);
+        }
+        // everything that can change which branches get tags or their IDs
+        HashStream out;
+        M.print(out, nullptr);
+        out << "\nmode=" << (int)KeyPointsMode.getValue() << " insertion-point=" << (int)KeyPointsEntryPoint.getValue()
+            << " promote=" << PromoteCounters << " branchless=" << Branchless << " strip-prefix=" << StripPrefix
+            << " strip-debug=" << StripDebug;
+        for (auto &path : {PruneCounters.getValue(), PruneDictionary.getValue()}) {
+            // the pruned probes and kept IDs depend on what's in the files
+            if (auto file = MemoryBuffer::getFile(path)) {
+                out << " " << path << "=" << xxHash64((*file)->getBuffer());
+            }
+        }
+        key = out.hash();
+    }
+
+    std::string counterFile() const { return path("counter.log"); }
+
+    // Returns the module's first ID and dictionary entries from an earlier
+    // compile with the same key and number of tags.
+    bool lookup(size_t tags, int &firstId, std::string &entries) {
+        auto file = MemoryBuffer::getFile(path(hex(key) + ".dict"));
+        if (!file) {
+            return false;
+        }
+        StringRef contents = (*file)->getBuffer();
+        if ((size_t)contents.count('\n') != tags || tags == 0) {
+            return false;
+        }
+        StringRef first = contents;
+        if (!first.consume_front("br_") || first.take_until([](char c) { return c == ':'; }).getAsInteger(10, firstId)) {
+            return false;
+        }
+        entries = contents.str();
+        track();
+        return true;
+    }
+
+    // Records the module's entries under the current key.
+    void store(StringRef entries) {
+        writeFile(path(hex(key) + ".dict"), entries);
+        track();
+    }
+
+    private:
+    std::string moduleName;
+    uint64_t key;
+    // configurations of one module kept at a time
+    static constexpr size_t KeysPerModule = 8;
+
+    static std::string hex(uint64_t value) {
+        std::string text;
+        raw_string_ostream(text) << format_hex_no_prefix(value, 16);
+        return text;
+    }
+    std::string path(const Twine &name) const {
+        return (Twine(CacheDir) + "/" + name).str();
+    }
+    // Moves the current key to the front of the module's keys, deleting the
+    // entries of the least recently used ones beyond KeysPerModule.
+    void track() {
+        auto modulePath = path(hex(xxHash64(moduleName)) + ".module");
+        auto current = hex(key);
+        std::vector<std::string> keys{current};
+        if (auto file = MemoryBuffer::getFile(modulePath)) {
+            SmallVector<StringRef, 16> lines;
+            // the first line is the module name
+            (*file)->getBuffer().split(lines, '\n', -1, /*KeepEmpty=*/false);
+            for (size_t i = 1; i < lines.size(); i++) {
+                if (lines[i].size() == 16 && lines[i] != current) {
+                    keys.push_back(lines[i].str());
+                }
+            }
+            if (lines.size() > 1 && lines[1] == current) {
+                return;
+            }
+        }
+        for (size_t i = KeysPerModule; i < keys.size(); i++) {
+            sys::fs::remove(path(keys[i] + ".dict"));
+        }
+        keys.resize(std::min(keys.size(), KeysPerModule));
+        std::string contents = moduleName + "\n";
+        for (auto &k : keys) {
+            contents += k + "\n";
+        }
+        writeFile(modulePath, contents);
+    }
+    // Written to a temporary file and renamed so concurrent compiles never
+    // see part of a file.
+    static void writeFile(const std::string &target, StringRef contents) {
+        auto temporary = target + ".tmp." + std::to_string(getpid());
+        {
+            std::ofstream out(temporary, std::ios_base::trunc);
+            out << contents.str();
+            if (!out) {
+                report_fatal_error(Twine("unable to write ") + temporary);
+            }
+        }
+        if (sys::fs::rename(temporary, target)) {
+            report_fatal_error(Twine("unable to write ") + target);
+        }
+    }
+};
+
+// Coverage of an earlier build for -keypoints-prune-counters. A module whose
+// tags still match its entries in that build's dictionary keeps the same IDs,
+// so the dictionary and counter layout stay the same and new dumps can be
+// merged with the old ones, and the tags that already ran get no probe.
+class PriorCoverage {
+    public:
+    struct Entry {
+        int id;
+        int condition_line;
+        int block_start_line;
+    };
+
+    // Loaded once and shared by every module the plugin instruments, or null
+    // if pruning wasn't asked for.
+    static const PriorCoverage *get() {
+        static std::unique_ptr<PriorCoverage> prior = load();
+        return prior.get();
+    }
+
+    bool covered(int id) const {
+        return id >= 0 && (size_t)id < counts.size() && counts[id] > 0;
+    }
+    // One past the highest ID of the earlier build. New IDs are taken from
+    // here on so they never collide with a module that kept its IDs.
+    int end() const { return nextId; }
+    // The module's entries in ID order, or null if it wasn't in the build.
+    const std::vector<Entry> *module(StringRef name) const {
+        auto it = modules.find(name);
+        return it == modules.end() ? nullptr : &it->second;
+    }
+
+    private:
+    StringMap<std::vector<Entry>> modules;
+    std::vector<uint64_t> counts;
+    int nextId = 0;
+
+    static std::unique_ptr<PriorCoverage> load() {
+        if (PruneCounters.empty()) {
+            return nullptr;
+        }
+        if (PruneDictionary.empty()) {
+            report_fatal_error("-keypoints-prune-counters needs -keypoints-prune-dictionary");
+        }
+        auto prior = std::make_unique<PriorCoverage>();
+        std::ifstream dictionary(PruneDictionary);
+        if (!dictionary) {
+            report_fatal_error(Twine("unable to open ") + PruneDictionary);
+        }
+        uint64_t dictionaryHash = 0;
+        std::string line;
+        while (std::getline(dictionary, line)) {
+            // br_N: file, condition_line, block_start_line
+            StringRef rest(line);
+            if (!rest.consume_front("br_")) {
+                continue;
+            }
+            auto [idText, location] = rest.split(": ");
+            auto [fileAndCondition, blockText] = location.rsplit(", ");
+            auto [file, conditionText] = fileAndCondition.rsplit(", ");
+            Entry E;
+            if (idText.getAsInteger(10, E.id) || conditionText.getAsInteger(10, E.condition_line) ||
+                blockText.getAsInteger(10, E.block_start_line)) {
+                continue;
+            }
+            dictionaryHash += hashDictionaryLine(line);
+            prior->modules[file].push_back(E);
+            prior->nextId = std::max(prior->nextId, E.id + 1);
+        }
+        for (auto &module : prior->modules) {
+            std::sort(module.second.begin(), module.second.end(),
+                [](const Entry &a, const Entry &b) { return a.id < b.id; });
+        }
+
+        // same layout as csc512project_counter_header in branchlog.c
+        struct {
+            char magic[8];
+            uint64_t dictionary_hash;
+            uint64_t num_counters;
+            uint64_t runs;
+        } header;
+        std::ifstream dump(PruneCounters, std::ios::binary);
+        if (!dump.read(reinterpret_cast<char *>(&header), sizeof(header)) || memcmp(header.magic, "KPCOUNT1", 8) != 0) {
+            report_fatal_error(Twine(PruneCounters) + " is not a counter dump");
+        }
+        if (header.dictionary_hash != dictionaryHash) {
+            report_fatal_error(Twine(PruneCounters) + " was not recorded against " + PruneDictionary);
+        }
+        prior->counts.resize(header.num_counters);
+        if (!dump.read(reinterpret_cast<char *>(prior->counts.data()), header.num_counters * sizeof(uint64_t))) {
+            report_fatal_error(Twine(PruneCounters) + " is truncated");
+        }
+        return prior;
+    }
+};
+
 struct KeyPointsPass : public PassInfoMixin<KeyPointsPass> {
     private: 
     int counter;
-    std::set<BasicBlock*> seen;
+    int firstId;
+    // a successor of a conditional branch or switch that gets a tag
+    struct Tag {
+        BasicBlock *block;
+        Instruction *branch;
+        unsigned successor;
+        int condition_line;
+    };
+    // (predecessor, block) pairs already tagged. The predecessor is only set
+    // when tagging edges after optimization, otherwise each block gets one tag.
+    DenseSet<std::pair<BasicBlock*, BasicBlock*>> seen;
+    // tags in the order they're found; IDs are assigned and probes inserted
+    // once the whole module is scanned, since the number of tags decides both
+    // the ID range to reserve and the size of the counter array
+    std::vector<Tag> pending;
     std::vector<BranchEntry> branchEntries;
+    // the module's dictionary lines, formatted or taken from the cache
+    std::string dictionary;
+    std::unique_ptr<BuildCache> cache;
+    // the IDs and dictionary came from the cache
+    bool cacheHit = false;
+    GlobalVariable *counters = nullptr;
+    // the load/add/store of every counter increment, for loop promotion
+    struct Increment {
+        LoadInst *load;
+        Instruction *add;
+        StoreInst *store;
+    };
+    std::vector<Increment> increments;
+    // runtime functions, looked up once per module rather than per probe
+    FunctionCallee logBranch;
+    FunctionCallee logFunctionPointer;
+    FunctionCallee flushPath;
+    // in path mode, each instrumented function is identified by its first tag ID
+    MapVector<Function*, int> functionIds;
+    // conditional branches skipped for lack of a debug location
+    int unlocated = 0;
     int getStartLine(BasicBlock &BB) {
         for (auto &I : BB) {
             if (I.getDebugLoc()) {
@@ -56,32 +512,361 @@ struct KeyPointsPass : public PassInfoMixin<KeyPointsPass> {
         // it shouldn't cause program issues, just some funky output
         return -1;
     };
-    void addFilePrint(Module &M, Instruction &I, BranchEntry &BE) {
-        // info on linking to externally defined library from: https://www.cs.cornell.edu/~asampson/blog/llvm.html
-        LLVMContext &context = M.getContext();
-        // hopefully this name is unique enough to not cause collisions
-        auto logFunc = M.getOrInsertFunction("csc512project_log_branch", Type::getVoidTy(context), Type::getInt32Ty(context));
+    void addCounterIncrement(IRBuilder<> &builder, int id, Value *step) {
+        // a plain load/add/store like -fprofile-instr-generate; increments from
+        // multiple threads can race, but that only loses counts
+        auto counterPtr = builder.CreateConstInBoundsGEP2_32(counters->getValueType(), counters, 0, id - firstId);
+        auto count = builder.CreateLoad(builder.getInt64Ty(), counterPtr);
+        auto add = builder.CreateAdd(count, step);
+        auto store = builder.CreateStore(add, counterPtr);
+        increments.push_back({count, cast<Instruction>(add), store});
+    };
+    // Counts the successor of a conditional branch from the branching block by
+    // adding the condition (or its inverse) to the counter, rather than with an
+    // increment in the successor. The successor stays free of probes so
+    // SimplifyCFG can still if-convert it, and with promotion the counter
+    // becomes an ordinary add reduction that doesn't stop the loop vectorizer.
+    // Only valid when the branch is the successor's only way in.
+    bool addBranchlessIncrement(Tag &T, int id) {
+        auto BI = dyn_cast<BranchInst>(T.branch);
+        if (!BI || !BI->isConditional() || BI->getSuccessor(0) == BI->getSuccessor(1) ||
+            T.block->getSinglePredecessor() != BI->getParent()) {
+            return false;
+        }
+        IRBuilder<> builder(BI);
+        auto taken = T.successor == 0 ? BI->getCondition() : builder.CreateNot(BI->getCondition());
+        // zext is what instcombine turns select(c, 1, 0) into anyway
+        addCounterIncrement(builder, id, builder.CreateZExt(taken, builder.getInt64Ty()));
+        return true;
+    };
+    void addFilePrint(Module &M, Instruction &I, int id) {
         IRBuilder<> builder(&I);
-        Value *arg(builder.getInt32(BE.id));
-        builder.CreateCall(logFunc, arg, "brtag" + std::to_string(BE.id));
+        if (KeyPointsMode == Mode::Counter) {
+            addCounterIncrement(builder, id, builder.getInt64(1));
+            return;
+        }
+        if (KeyPointsMode == Mode::Path) {
+            if (!logBranch) {
+                LLVMContext &context = M.getContext();
+                logBranch = M.getOrInsertFunction("csc512project_path_branch", Type::getVoidTy(context),
+                    Type::getInt32Ty(context), Type::getInt32Ty(context));
+            }
+            auto functionId = functionIds.insert({I.getFunction(), id}).first->second;
+            builder.CreateCall(logBranch, {builder.getInt32(functionId), builder.getInt32(id)});
+            return;
+        }
+        if (!logBranch) {
+            // info on linking to externally defined library from: https://www.cs.cornell.edu/~asampson/blog/llvm.html
+            LLVMContext &context = M.getContext();
+            // hopefully this name is unique enough to not cause collisions
+            auto logName = KeyPointsMode == Mode::Timing ? "csc512project_time_branch" : "csc512project_log_branch";
+            logBranch = M.getOrInsertFunction(logName, Type::getVoidTy(context), Type::getInt32Ty(context));
+        }
+        Value *arg(builder.getInt32(id));
+        builder.CreateCall(logBranch, arg);
+    };
+    bool tagEdges() {
+        return KeyPointsEntryPoint == EntryPoint::OptimizerLast;
     };
-    void addBranchTag(Module &M, int condition_line, BasicBlock &BB) {
-        if(!seen.insert(&BB).second) {
+    void addBranchTag(int condition_line, Instruction &branch, unsigned successor) {
+        auto &BB = *branch.getSuccessor(successor);
+        if(!seen.insert({tagEdges() ? branch.getParent() : nullptr, &BB}).second) {
             // we've already seen this one and transformed it
             return;
         }
-        BranchEntry BE(counter++, M.getName(), condition_line, getStartLine(BB));
-        branchEntries.push_back(BE);
-        for (auto &I : BB) {
-            addFilePrint(M, I, BE);
-            // break after the first instruction because we only want to insert the tag at the start of the block
-            break;
+        pending.push_back({&BB, &branch, successor, condition_line});
+    };
+    StringRef moduleName(Module &M) {
+        auto name = M.getName();
+        if (!StripPrefix.empty()) {
+            name.consume_front(StripPrefix);
         }
+        return name;
     };
-    void handleSwitch(Module &M, SwitchInst &SI) {
+    // One line per branch or switch giving the IDs of its tags, so tools can
+    // tell apart branches that share a source line. Consecutive tags come from
+    // the same branch, since each branch adds all of its tags at once.
+    void writeBranchSites() {
+        std::string contents;
+        raw_string_ostream out(contents);
+        for (size_t i = 0; i < pending.size(); i++) {
+            if (i > 0) {
+                out << (pending[i].branch == pending[i - 1].branch ? " " : "\n");
+            }
+            out << "br_" << firstId + i;
+        }
+        if (!pending.empty()) {
+            out << "\n";
+        }
+        out.flush();
+        appendEntries(SitesFile, contents, cacheHit);
+    };
+    void assignIds(Module &M) {
+        auto name = moduleName(M);
+        if (cache && cache->lookup(pending.size(), firstId, dictionary)) {
+            counter = firstId + pending.size();
+            NumTags += pending.size();
+            NumCacheHits++;
+            cacheHit = true;
+            return;
+        }
+        std::vector<int> startLines;
+        startLines.reserve(pending.size());
+        for (auto &T : pending) {
+            startLines.push_back(getStartLine(*T.block));
+        }
+        auto prior = PriorCoverage::get();
+        firstId = prior ? priorFirstId(name, *prior, startLines) : -1;
+        if (firstId < 0) {
+            firstId = reserveIds(cache ? cache->counterFile() : CounterFile.getValue(), pending.size(), prior ? prior->end() : 0);
+        }
+        counter = firstId;
+        branchEntries.reserve(pending.size());
+        for (size_t i = 0; i < pending.size(); i++) {
+            branchEntries.emplace_back(counter++, name, pending[i].condition_line, startLines[i]);
+        }
+        dictionary = formatBranchDictionary(branchEntries);
+        if (cache && !pending.empty()) {
+            cache->store(dictionary);
+        }
+        NumTags += pending.size();
+    };
+    // The first ID the module had in the earlier build, or -1 if it has
+    // changed since, in which case it gets new IDs and nothing is pruned.
+    int priorFirstId(StringRef name, const PriorCoverage &prior, const std::vector<int> &startLines) {
+        auto entries = prior.module(name);
+        if (!entries) {
+            return -1;
+        }
+        bool same = entries->size() == pending.size();
+        for (size_t i = 0; same && i < pending.size(); i++) {
+            auto &E = (*entries)[i];
+            same = E.id == (*entries)[0].id + (int)i && E.condition_line == pending[i].condition_line &&
+                E.block_start_line == startLines[i];
+        }
+        if (!same) {
+            errs() << "keypoints: warning: " << name << " changed since " << PruneDictionary
+                   << " was written, so its branches get new IDs and none are pruned\n";
+            return -1;
+        }
+        return (*entries)[0].id;
+    };
+    void insertProbes(Module &M) {
+        if (KeyPointsMode == Mode::Counter && !pending.empty()) {
+            auto arrayTy = ArrayType::get(Type::getInt64Ty(M.getContext()), pending.size());
+            counters = new GlobalVariable(M, arrayTy, false, GlobalValue::PrivateLinkage,
+                ConstantAggregateZero::get(arrayTy), "csc512project_counters");
+        }
+        auto prior = PriorCoverage::get();
+        for (size_t i = 0; i < pending.size(); i++) {
+            if (prior && prior->covered(firstId + i)) {
+                // the tag stays in the dictionary, it just isn't recorded again
+                NumPruned++;
+                continue;
+            }
+            if (KeyPointsMode == Mode::Counter && Branchless && addBranchlessIncrement(pending[i], firstId + i)) {
+                NumBranchless++;
+                continue;
+            }
+            auto target = pending[i].block;
+            if (tagEdges() && !target->getSinglePredecessor()) {
+                // after optimization, blocks are commonly shared between
+                // branches, so put the probe on its own block on the edge
+                auto split = SplitCriticalEdge(pending[i].branch, pending[i].successor,
+                    CriticalEdgeSplittingOptions().setMergeIdenticalEdges());
+                if (split) {
+                    target = split;
+                    NumSplitEdges++;
+                }
+            }
+            // insert at the start of the block, but after any PHI nodes or
+            // landing pads, which must come first
+            auto IP = target->getFirstInsertionPt();
+            if (IP == target->end()) {
+                // e.g. catchswitch blocks, which can't hold anything else
+                continue;
+            }
+            addFilePrint(M, *IP, firstId + i);
+            NumProbes++;
+        }
+    };
+    // Ends the current path before anything that can run other instrumented
+    // code, i.e. calls, and before the function returns or unwinds, so a path
+    // only ever holds tags of one invocation between two calls. Calls through
+    // pointers are left out, since csc512project_path_fp already ends the path.
+    void insertPathFlushes(Module &M) {
+        for (auto &[F, id] : functionIds) {
+            for (auto &BB : *F) {
+                for (auto &I : BB) {
+                    if (auto CB = dyn_cast<CallBase>(&I)) {
+                        auto callee = CB->getCalledFunction();
+                        if (CB->isInlineAsm() || isa<IntrinsicInst>(CB) || CB->isIndirectCall() ||
+                            (callee && callee->getName().startswith("csc512project_"))) {
+                            continue;
+                        }
+                    } else if (!isa<ReturnInst>(I) && !isa<ResumeInst>(I)) {
+                        continue;
+                    }
+                    if (!flushPath) {
+                        flushPath = M.getOrInsertFunction("csc512project_path_flush", Type::getVoidTy(M.getContext()));
+                    }
+                    CallInst::Create(flushPath, "", &I);
+                }
+            }
+        }
+    };
+    // How many times BB runs each time L is entered, in terms of the loop's
+    // backedge-taken count, or null if that isn't known. The header runs once
+    // per iteration, as does anything dominating the latch when the latch is
+    // the only exit. A latch that unconditionally branches back to the header
+    // runs once per backedge.
+    const SCEV *executionCount(Loop &L, BasicBlock &BB, const SCEV *backedges, DominatorTree &DT, ScalarEvolution &SE) {
+        auto int64Ty = Type::getInt64Ty(BB.getContext());
+        auto iterations = SE.getAddExpr(backedges, SE.getOne(int64Ty));
+        if (&BB == L.getHeader()) {
+            return iterations;
+        }
+        auto latch = L.getLoopLatch();
+        if (!latch) {
+            return nullptr;
+        }
+        if (&BB == latch && latch->getSingleSuccessor() == L.getHeader()) {
+            return backedges;
+        }
+        if (L.getExitingBlock() == latch && DT.dominates(&BB, latch)) {
+            return iterations;
+        }
+        return nullptr;
+    };
+    // Whether L contains a call that may leave it without taking one of its
+    // exits, like exit(), longjmp() or a throw.
+    static bool mayLeaveEarly(Loop &L) {
+        for (auto BB : L.blocks()) {
+            for (auto &I : *BB) {
+                auto CB = dyn_cast<CallBase>(&I);
+                if (CB && (!CB->willReturn() || CB->mayThrow())) {
+                    return true;
+                }
+            }
+        }
+        return false;
+    };
+    // Rewrites the counter increments inside loops, the same way InstrProf's
+    // counter promotion does. Increments in blocks that run once per iteration
+    // of a loop with a computable trip count become a single add of the trip
+    // count in the preheader. The rest are kept in a register for the whole
+    // loop, loaded in the preheader and stored back in each exit block. Counts
+    // accumulated in a register are lost if the program leaves the loop without
+    // taking an exit, e.g. by calling exit() or longjmp(). A trip count added up
+    // front would instead count iterations that never ran, so loops containing
+    // a call that may not return are never hoisted.
+    void promoteCounters(Module &M, ModuleAnalysisManager &AM) {
+        auto &FAM = AM.getResult<FunctionAnalysisManagerModuleProxy>(M).getManager();
+        MapVector<Function*, std::vector<Increment>> byFunction;
+        for (auto &inc : increments) {
+            byFunction[inc.load->getFunction()].push_back(inc);
+        }
+        for (auto &[F, incs] : byFunction) {
+            // the probes and split edges invalidate anything computed earlier
+            FAM.invalidate(*F, PreservedAnalyses::none());
+            auto &DT = FAM.getResult<DominatorTreeAnalysis>(*F);
+            auto &LI = FAM.getResult<LoopAnalysis>(*F);
+            auto &SE = FAM.getResult<ScalarEvolutionAnalysis>(*F);
+            MapVector<Loop*, std::vector<Increment>> byLoop;
+            for (auto &inc : incs) {
+                if (auto L = LI.getLoopFor(inc.load->getParent())) {
+                    byLoop[L].push_back(inc);
+                }
+            }
+            for (auto &[L, loopIncs] : byLoop) {
+                promoteLoop(M, *L, loopIncs, DT, SE);
+            }
+        }
+    };
+    void promoteLoop(Module &M, Loop &L, std::vector<Increment> &loopIncs, DominatorTree &DT, ScalarEvolution &SE) {
+        auto preheader = L.getLoopPreheader();
+        SmallVector<BasicBlock*, 8> exits;
+        L.getUniqueExitBlocks(exits);
+        // every exit gets a store per counter, so don't blow up code size on
+        // loops with many exits
+        if (!preheader || !L.hasDedicatedExits() || exits.size() > 8) {
+            return;
+        }
+        for (auto exit : exits) {
+            if (exit->getFirstInsertionPt() == exit->end()) {
+                return;
+            }
+        }
+        auto int64Ty = Type::getInt64Ty(M.getContext());
+        auto backedges = SE.getBackedgeTakenCount(&L);
+        bool hoistable = !isa<SCEVCouldNotCompute>(backedges) && !mayLeaveEarly(L);
+        if (hoistable) {
+            backedges = SE.getTruncateOrZeroExtend(backedges, int64Ty);
+        }
+        SCEVExpander expander(SE, M.getDataLayout(), "keypoints.tripcount");
+        auto preheaderEnd = preheader->getTerminator();
+        for (auto &inc : loopIncs) {
+            auto counterPtr = inc.store->getPointerOperand();
+            const SCEV *count = nullptr;
+            // branchless increments add the condition, not one per execution
+            auto step = dyn_cast<ConstantInt>(inc.add->getOperand(1));
+            if (step && step->isOne() && hoistable) {
+                count = executionCount(L, *inc.load->getParent(), backedges, DT, SE);
+            }
+#if LLVM_VERSION_MAJOR >= 15
+            bool canExpand = count && expander.isSafeToExpandAt(count, preheaderEnd);
+#else
+            bool canExpand = count && isSafeToExpandAt(count, preheaderEnd, SE);
+#endif
+            if (canExpand) {
+                IRBuilder<> builder(preheaderEnd);
+                auto countValue = expander.expandCodeFor(count, int64Ty, preheaderEnd);
+                auto old = builder.CreateLoad(int64Ty, counterPtr);
+                builder.CreateStore(builder.CreateAdd(old, countValue), counterPtr);
+                NumHoisted++;
+            } else {
+                SSAUpdater SSA;
+                SSA.Initialize(int64Ty, "keypoints.counter");
+                SSA.AddAvailableValue(preheader, new LoadInst(int64Ty, counterPtr, "", preheaderEnd));
+                SSA.AddAvailableValue(inc.add->getParent(), inc.add);
+                inc.load->replaceAllUsesWith(SSA.GetValueInMiddleOfBlock(inc.load->getParent()));
+                for (auto exit : exits) {
+                    new StoreInst(SSA.GetValueInMiddleOfBlock(exit), counterPtr, &*exit->getFirstInsertionPt());
+                }
+                inc.store->eraseFromParent();
+                inc.load->eraseFromParent();
+                NumPromoted++;
+                continue;
+            }
+            inc.store->eraseFromParent();
+            inc.add->eraseFromParent();
+            inc.load->eraseFromParent();
+        }
+    };
+    // Adds a constructor that tells the runtime which IDs this module owns and
+    // where its counters live, so it can size and dump them at exit.
+    void registerModule(Module &M, uint64_t dictionaryHash) {
+        LLVMContext &context = M.getContext();
+        auto int64Ptr = Type::getInt64Ty(context)->getPointerTo();
+        auto registerFunc = M.getOrInsertFunction("csc512project_register_module", Type::getVoidTy(context),
+            Type::getInt64Ty(context), Type::getInt32Ty(context), Type::getInt32Ty(context), int64Ptr);
+        auto ctor = Function::Create(FunctionType::get(Type::getVoidTy(context), false),
+            GlobalValue::InternalLinkage, "csc512project_module_ctor", M);
+        IRBuilder<> builder(BasicBlock::Create(context, "entry", ctor));
+        Value *counterArg = counters
+            ? builder.CreatePointerCast(counters, int64Ptr)
+            : (Value *)ConstantPointerNull::get(int64Ptr);
+        builder.CreateCall(registerFunc, {builder.getInt64(dictionaryHash), builder.getInt32(firstId),
+            builder.getInt32(counter - firstId), counterArg});
+        builder.CreateRetVoid();
+        appendToGlobalCtors(M, ctor, 0);
+    };
+    void handleSwitch(SwitchInst &SI) {
         if (!SI.getDebugLoc()) {
             // invalid debug location so don't attempt since getting the condition line will fail
             // this results in the plugin essentially being a no-op if clang is run without -g
+            unlocated++;
+            NumUnlocated++;
             return;
         }
         auto condition_line = SI.getDebugLoc().getLine();
@@ -92,79 +877,156 @@ struct KeyPointsPass : public PassInfoMixin<KeyPointsPass> {
                 // skip the default block for the end
                 continue;
             }
-            addBranchTag(M, condition_line, S);
+            addBranchTag(condition_line, SI, i);
         }
-        addBranchTag(M, condition_line, D);
+        // the default destination is always successor 0
+        addBranchTag(condition_line, SI, 0);
     };
-    void handleBranch(Module &M, BranchInst &BI) {
-        if (!BI.getDebugLoc()) {
-            // invalid debug location so don't attempt since getting the condition line will fail
-            // this results in the plugin essentially being a no-op if clang is run without -g
+    void handleBranch(BranchInst &BI) {
+        if (BI.isUnconditional()) {
             return;
         }
 
-        if (BI.isUnconditional()) {
+        if (!BI.getDebugLoc()) {
+            // invalid debug location so don't attempt since getting the condition line will fail
+            // this results in the plugin essentially being a no-op if clang is run without -g
+            unlocated++;
+            NumUnlocated++;
             return;
         }
 
-        auto condition = BI.getSuccessor(0);
-        addBranchTag(M, BI.getDebugLoc().getLine(), *condition);
-        auto alternative = BI.getSuccessor(1);
-        addBranchTag(M, BI.getDebugLoc().getLine(), *alternative);
+        // successor 0 is the condition's block and 1 the alternative
+        addBranchTag(BI.getDebugLoc().getLine(), BI, 0);
+        addBranchTag(BI.getDebugLoc().getLine(), BI, 1);
     };
+    // Calls after which the process image is gone without running atexit
+    // handlers, so the runtime never gets to write out a buffered trace.
+    static bool endsProcessImage(StringRef name) {
+        return StringSwitch<bool>(name)
+            .Cases("execl", "execle", "execlp", "execv", "execve", "execvp", "execvpe", "fexecve", true)
+            .Cases("_exit", "_Exit", true)
+            .Default(false);
+    }
+    // Modes that record an ordered stream of events; the others only aggregate
+    // per tag, where an indirect call has nowhere to go.
+    static bool recordsEvents() {
+        return KeyPointsMode == Mode::Trace || KeyPointsMode == Mode::Path;
+    }
     void handleCall(Module &M, CallInst &CI) {
         if(!CI.isIndirectCall()) {
-            // if it's a direct call, it's not through a function pointer so we don't care
+            auto callee = CI.getCalledFunction();
+            if (recordsEvents() && callee && endsProcessImage(callee->getName())) {
+                auto flushFunc = M.getOrInsertFunction("csc512project_flush_trace", Type::getVoidTy(M.getContext()));
+                IRBuilder<> builder(&CI);
+                builder.CreateCall(flushFunc);
+            }
+            // otherwise if it's a direct call, it's not through a function pointer so we don't care
+            return;
+        }
+        if (!recordsEvents()) {
+            // logging would open branch_trace.txt on every call and keep an
+            // opaque call in loops that counter promotion should handle
             return;
         }
         auto op = CI.getCalledOperand();
         LLVMContext &context = M.getContext();
-        auto voidptr = Type::getVoidTy(context)->getPointerTo();
-        // hopefully this name is unique enough to not cause collisions
-        auto logFunc = M.getOrInsertFunction("csc512project_log_fp", Type::getVoidTy(context), voidptr);
+        auto voidptr = Type::getInt8PtrTy(context);
+        if (!logFunctionPointer) {
+            // hopefully this name is unique enough to not cause collisions
+            auto logName = KeyPointsMode == Mode::Path ? "csc512project_path_fp" : "csc512project_log_fp";
+            logFunctionPointer = M.getOrInsertFunction(logName, Type::getVoidTy(context), voidptr);
+        }
         IRBuilder<> builder(&CI);
-        Value *arg(op);
-        builder.CreateCall(logFunc, arg, "fptag");
+        // a no-op with opaque pointers, but typed pointers need the cast
+        Value *arg = builder.CreatePointerCast(op, voidptr);
+        builder.CreateCall(logFunctionPointer, arg);
+        NumFunctionPointers++;
     }
-    void recordCounter(int counter) {
-        std::ofstream f("counter.log");
-        f << counter;
-        f.close();
-    };
-    int initCounter() {
-        std::filesystem::path counter_log{ "counter.log" };
-        if (std::filesystem::exists(counter_log)) {
-            std::ifstream in("counter.log");
-            std::string content((std::istreambuf_iterator<char>(in)),(std::istreambuf_iterator<char>()));
-            auto ctr = std::stoi(content);
-            return ctr;
-        } else {
-            return 0;
+    // Takes the next `count` IDs from the counter file, starting at `floor` or
+    // later. The file is locked for the read and update so concurrent compiles
+    // sharing one counter file, as keypoints-build does, always get disjoint
+    // ranges.
+    int reserveIds(const std::string &counterFile, int count, int floor) {
+        int fd = open(counterFile.c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd < 0) {
+            report_fatal_error(Twine("unable to open ") + counterFile);
+        }
+        flock(fd, LOCK_EX);
+        char content[32] = {};
+        auto n = pread(fd, content, sizeof(content) - 1, 0);
+        int first = std::max(n > 0 ? std::atoi(content) : 0, floor);
+        auto next = std::to_string(first + count);
+        if (ftruncate(fd, 0) != 0 || pwrite(fd, next.data(), next.size(), 0) != (ssize_t)next.size()) {
+            report_fatal_error(Twine("unable to update ") + counterFile);
         }
+        flock(fd, LOCK_UN);
+        close(fd);
+        return first;
     }
     public:
     PreservedAnalyses run(Module &M, ModuleAnalysisManager &AM) {
-        counter = initCounter();
-        for (auto &F : M) {
-            for (auto &B : F) {
-                for (auto &I : B) {
-                    if (isa<SwitchInst>(I)) {
-                        auto SI = dyn_cast<SwitchInst>(&I);
-                        handleSwitch(M, *SI);
-                    }
-                    if (isa<BranchInst>(I)) {
-                        auto BI = dyn_cast<BranchInst>(&I);
-                        handleBranch(M, *BI);
-                    }
-                    if (isa<CallInst>(I)) {
-                        auto CI = dyn_cast<CallInst>(&I);
-                        handleCall(M, *CI);
+        if (!CacheDir.empty()) {
+            NamedRegionTimer timer("hash-module", "Hash the module for the cache", TimerGroupName, TimerGroupDescription, TimePassesIsEnabled);
+            // hashed before anything is inserted, so it only depends on the input
+            cache = std::make_unique<BuildCache>(M, moduleName(M));
+        }
+        {
+            NamedRegionTimer timer("scan", "Find branches", TimerGroupName, TimerGroupDescription, TimePassesIsEnabled);
+            for (auto &F : M) {
+                if (F.getName().startswith("csc512project_")) {
+                    // don't instrument the runtime itself if it's compiled with the plugin
+                    continue;
+                }
+                for (auto &B : F) {
+                    for (auto &I : B) {
+                        if (isa<SwitchInst>(I)) {
+                            auto SI = dyn_cast<SwitchInst>(&I);
+                            handleSwitch(*SI);
+                        }
+                        if (isa<BranchInst>(I)) {
+                            auto BI = dyn_cast<BranchInst>(&I);
+                            handleBranch(*BI);
+                        }
+                        if (isa<CallInst>(I)) {
+                            auto CI = dyn_cast<CallInst>(&I);
+                            handleCall(M, *CI);
+                        }
                     }
                 }
             }
         }
-        writeBranchDictionary(branchEntries);
-        recordCounter(counter);
+        {
+            NamedRegionTimer timer("assign-ids", "Reserve IDs and compute block lines", TimerGroupName, TimerGroupDescription, TimePassesIsEnabled);
+            assignIds(M);
+        }
+        {
+            NamedRegionTimer timer("insert-probes", "Insert probes", TimerGroupName, TimerGroupDescription, TimePassesIsEnabled);
+            insertProbes(M);
+            if (KeyPointsMode == Mode::Path) {
+                insertPathFlushes(M);
+            }
+        }
+        if (KeyPointsMode == Mode::Counter && PromoteCounters) {
+            NamedRegionTimer timer("promote-counters", "Promote loop counters", TimerGroupName, TimerGroupDescription, TimePassesIsEnabled);
+            promoteCounters(M, AM);
+        }
+        {
+            NamedRegionTimer timer("write-dictionary", "Write the dictionary and register the module", TimerGroupName, TimerGroupDescription, TimePassesIsEnabled);
+            auto dictionaryHash = writeBranchDictionary(dictionary, cacheHit);
+            writeBranchSites();
+            if (counter > firstId) {
+                registerModule(M, dictionaryHash);
+            }
+        }
+        if (unlocated > 0 && !M.getNamedMetadata("llvm.dbg.cu")) {
+            // line tables are all the pass needs, so say how to get them cheaply
+            errs() << "keypoints: warning: " << moduleName(M) << " has no line information, so " << unlocated
+                   << (unlocated == 1 ? " branch was" : " branches were") << " not instrumented; compile with -gline-tables-only, and -mllvm -keypoints-strip-debug to leave it out of the object\n";
+        }
+        if (StripDebug) {
+            StripDebugInfo(M);
+        }
+        printStatistics();
         return PreservedAnalyses::none();
     };
 };
@@ -179,8 +1041,16 @@ llvmGetPassPluginInfo() {
         .PluginVersion = "v0.1",
         .RegisterPassBuilderCallbacks = [](PassBuilder &PB) {
             PB.registerPipelineStartEPCallback(
-                [](ModulePassManager &MPM, OptimizationLevel Level) {
-                    MPM.addPass(KeyPointsPass());
+                [](ModulePassManager &MPM, OptimizationLevel) {
+                    if (KeyPointsEntryPoint == EntryPoint::PipelineStart) {
+                        MPM.addPass(KeyPointsPass());
+                    }
+                });
+            PB.registerOptimizerLastEPCallback(
+                [](ModulePassManager &MPM, OptimizationLevel) {
+                    if (KeyPointsEntryPoint == EntryPoint::OptimizerLast) {
+                        MPM.addPass(KeyPointsPass());
+                    }
                 });
         }
     };
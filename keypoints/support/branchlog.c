@@ -1,15 +1,911 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <link.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// Every instrumented module registers the range of branch IDs it owns and, in
+// counter mode, its counter array from a constructor before main runs.
+struct csc512project_module {
+    uint64_t dictionary_hash;
+    int first_id;
+    int count;
+    uint64_t *counters;
+};
+
+static struct csc512project_module *csc512project_modules;
+static int csc512project_num_modules;
+
+// One past the highest branch ID of any registered module.
+static uint64_t csc512project_num_ids(void) {
+    uint64_t n = 0;
+    for (int i = 0; i < csc512project_num_modules; i++) {
+        struct csc512project_module *m = &csc512project_modules[i];
+        if ((uint64_t)(m->first_id + m->count) > n) {
+            n = m->first_id + m->count;
+        }
+    }
+    return n;
+}
+
+// Layout of branch_counters.{pid}.bin. The keypoints-merge tool reads the same
+// layout, so keep the two in sync.
+struct csc512project_counter_header {
+    char magic[8];
+    uint64_t dictionary_hash;
+    uint64_t num_counters;
+    uint64_t runs;
+};
+
+static void csc512project_dump_counters(void) {
+    struct csc512project_counter_header header;
+    memcpy(header.magic, "KPCOUNT1", 8);
+    header.dictionary_hash = 0;
+    header.num_counters = csc512project_num_ids();
+    header.runs = 1;
+    int has_counters = 0;
+    for (int i = 0; i < csc512project_num_modules; i++) {
+        struct csc512project_module *m = &csc512project_modules[i];
+        // the dictionary hash is a sum of per-line hashes so module order doesn't matter
+        header.dictionary_hash += m->dictionary_hash;
+        has_counters |= m->counters != NULL;
+    }
+    if (!has_counters) {
+        return;
+    }
+
+    uint64_t *all = calloc(header.num_counters, sizeof(uint64_t));
+    if (!all) {
+        return;
+    }
+    for (int i = 0; i < csc512project_num_modules; i++) {
+        struct csc512project_module *m = &csc512project_modules[i];
+        if (m->counters) {
+            memcpy(all + m->first_id, m->counters, m->count * sizeof(uint64_t));
+        }
+    }
+
+    char name[64];
+    snprintf(name, sizeof(name), "branch_counters.%d.bin", (int)getpid());
+    FILE *f = fopen(name, "wb");
+    if (f) {
+        fwrite(&header, sizeof(header), 1, f);
+        fwrite(all, sizeof(uint64_t), header.num_counters, f);
+        fclose(f);
+    }
+    free(all);
+}
+
+// Timing mode: the cycles from one probe to the next are charged to the first
+// probe's branch, so each branch accumulates the time spent in the code under
+// it, including anything it calls that has no probes of its own.
+#define CSC512PROJECT_TIMING_BUCKETS 48
+
+struct csc512project_timing {
+    uint64_t count;
+    uint64_t cycles;
+    // histogram of log2(cycles) per execution
+    uint64_t buckets[CSC512PROJECT_TIMING_BUCKETS];
+};
+
+static struct csc512project_timing *csc512project_timings;
+static uint64_t csc512project_num_timings;
+static __thread int csc512project_last_tag = -1;
+static __thread uint64_t csc512project_last_time;
+
+static inline uint64_t csc512project_now(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    // no cycle counter we can read from user space everywhere, so use nanoseconds
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+static void csc512project_charge(int br_tag, uint64_t now) {
+    if (br_tag < 0 || (uint64_t)br_tag >= csc512project_num_timings) {
+        return;
+    }
+    uint64_t delta = now - csc512project_last_time;
+    struct csc512project_timing *t = &csc512project_timings[br_tag];
+    // unsynchronized like the counters; concurrent updates may lose a sample
+    t->count++;
+    t->cycles += delta;
+    int bucket = delta == 0 ? 0 : 63 - __builtin_clzll(delta);
+    t->buckets[bucket < CSC512PROJECT_TIMING_BUCKETS ? bucket : CSC512PROJECT_TIMING_BUCKETS - 1]++;
+}
+
+void csc512project_time_branch(int br_tag) {
+    if (!csc512project_timings) {
+        // every module has registered by the time main runs, so the number of
+        // IDs is final here
+        uint64_t n = csc512project_num_ids();
+        struct csc512project_timing *t = calloc(n, sizeof(*t));
+        if (!t) {
+            return;
+        }
+        struct csc512project_timing *expected = NULL;
+        if (!__atomic_compare_exchange_n(&csc512project_timings, &expected, t, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            free(t);
+        } else {
+            __atomic_store_n(&csc512project_num_timings, n, __ATOMIC_RELEASE);
+        }
+    }
+    uint64_t now = csc512project_now();
+    csc512project_charge(csc512project_last_tag, now);
+    csc512project_last_tag = br_tag;
+    // read the clock again so the bookkeeping isn't charged to the next region
+    csc512project_last_time = csc512project_now();
+}
+
+static void csc512project_dump_timings(void) {
+    if (!csc512project_timings) {
+        return;
+    }
+    // close the region the exiting thread was in
+    csc512project_charge(csc512project_last_tag, csc512project_now());
+    char name[64];
+    snprintf(name, sizeof(name), "branch_timing.%d.txt", (int)getpid());
+    FILE *f = fopen(name, "w");
+    if (!f) {
+        return;
+    }
+#if defined(__x86_64__) || defined(__i386__)
+    fprintf(f, "# unit: tsc cycles\n");
+#else
+    fprintf(f, "# unit: nanoseconds\n");
+#endif
+    fprintf(f, "# br_N: executions, total, histogram of log2(time) as bucket:executions\n");
+    for (uint64_t i = 0; i < csc512project_num_timings; i++) {
+        struct csc512project_timing *t = &csc512project_timings[i];
+        if (t->count == 0) {
+            continue;
+        }
+        fprintf(f, "br_%d: %llu, %llu,", (int)i, (unsigned long long)t->count, (unsigned long long)t->cycles);
+        for (int b = 0; b < CSC512PROJECT_TIMING_BUCKETS; b++) {
+            if (t->buckets[b]) {
+                fprintf(f, " %d:%llu", b, (unsigned long long)t->buckets[b]);
+            }
+        }
+        fprintf(f, "\n");
+    }
+    fclose(f);
+}
+
+static void csc512project_dump_paths(void);
+
+static void csc512project_dump(void) {
+    csc512project_dump_counters();
+    csc512project_dump_timings();
+    csc512project_dump_paths();
+}
+
+void csc512project_register_module(uint64_t dictionary_hash, int first_id, int count, uint64_t *counters) {
+    struct csc512project_module *grown = realloc(csc512project_modules, (csc512project_num_modules + 1) * sizeof(*grown));
+    if (!grown) {
+        return;
+    }
+    if (csc512project_num_modules == 0) {
+        atexit(csc512project_dump);
+    }
+    csc512project_modules = grown;
+    grown[csc512project_num_modules].dictionary_hash = dictionary_hash;
+    grown[csc512project_num_modules].first_id = first_id;
+    grown[csc512project_num_modules].count = count;
+    grown[csc512project_num_modules].counters = counters;
+    csc512project_num_modules++;
+}
+
+// Ring mode: when KEYPOINTS_RING is set to a number of events, trace events go
+// into a ring buffer in a MAP_SHARED mapping of branch_trace.ring.{pid}
+// instead of branch_trace.txt. The kernel owns the pages, so the newest events
+// survive the process crashing, and logging an event is just a few stores.
+// Recover them with keypoints-ring. The keypoints-ring tool reads the same
+// layout, so keep the two in sync.
+struct csc512project_ring_header {
+    char magic[8];
+    // number of slots, always a power of two
+    uint64_t capacity;
+    // number of events ever written; the newest is in slot (head - 1) % capacity
+    uint64_t head;
+    // CSC512PROJECT_RING_* below
+    uint32_t state;
+    // the signal that sealed the ring, if any
+    int32_t signal;
+    uint64_t pid;
+    uint64_t reserved[3];
+};
+
+struct csc512project_ring_slot {
+    // position + 1 of the event in the slot, written after the event so a
+    // torn or overwritten slot can be detected; while a writer fills the slot
+    // it holds the writer's position + 1 with CSC512PROJECT_RING_BUSY set
+    uint64_t seq;
+    uint64_t event;
+};
+
+#define CSC512PROJECT_RING_BUSY (1ULL << 63)
+
+#define CSC512PROJECT_RING_OPEN 0
+#define CSC512PROJECT_RING_EXITED 1
+#define CSC512PROJECT_RING_SIGNALED 2
+// events with this bit set are function pointers, otherwise branch tags;
+// function pointers hold the object number in bits 48-62 and the offset below
+#define CSC512PROJECT_RING_FP (1ULL << 63)
+#define CSC512PROJECT_RING_OBJECT_SHIFT 48
+#define CSC512PROJECT_RING_OFFSET_MASK ((1ULL << 48) - 1)
+
+static struct csc512project_ring_header *csc512project_ring;
+static struct csc512project_ring_slot *csc512project_ring_slots;
+
+static void csc512project_ring_push(uint64_t event) {
+    uint64_t pos = __atomic_fetch_add(&csc512project_ring->head, 1, __ATOMIC_RELAXED);
+    struct csc512project_ring_slot *slot = &csc512project_ring_slots[pos & (csc512project_ring->capacity - 1)];
+    // Writers a whole lap apart can reach the same slot at once, e.g. when one
+    // is preempted between taking its position and writing. The slot is
+    // claimed by marking it busy, and only from an earlier lap that nobody is
+    // writing, so two writers never fill it together; an event whose slot is
+    // busy or already holds a later lap is dropped, and readers count it lost.
+    uint64_t seq = __atomic_load_n(&slot->seq, __ATOMIC_RELAXED);
+    do {
+        if ((seq & CSC512PROJECT_RING_BUSY) || seq >= pos + 1) {
+            return;
+        }
+    } while (!__atomic_compare_exchange_n(&slot->seq, &seq, (pos + 1) | CSC512PROJECT_RING_BUSY, 1,
+                                          __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    // a reader that sees the new event must also see the slot busy
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&slot->event, event, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+}
+
+static void csc512project_ring_seal(uint32_t state, int sig) {
+    if (csc512project_ring && csc512project_ring->state == CSC512PROJECT_RING_OPEN) {
+        csc512project_ring->signal = sig;
+        __atomic_store_n(&csc512project_ring->state, state, __ATOMIC_RELEASE);
+    }
+}
+
+static void csc512project_ring_exit(void) {
+    csc512project_ring_seal(CSC512PROJECT_RING_EXITED, 0);
+}
+
+static const int csc512project_fatal_signals[] = {SIGSEGV, SIGBUS, SIGABRT, SIGFPE, SIGILL};
+static struct sigaction csc512project_old_actions[sizeof(csc512project_fatal_signals) / sizeof(int)];
+
+static void csc512project_ring_signal(int sig, siginfo_t *info, void *context) {
+    csc512project_ring_seal(CSC512PROJECT_RING_SIGNALED, sig);
+    // hand the signal to whoever had it before us, or let it kill the process
+    for (size_t i = 0; i < sizeof(csc512project_fatal_signals) / sizeof(int); i++) {
+        if (csc512project_fatal_signals[i] != sig) {
+            continue;
+        }
+        struct sigaction *old = &csc512project_old_actions[i];
+        if (old->sa_flags & SA_SIGINFO) {
+            old->sa_sigaction(sig, info, context);
+            return;
+        }
+        if (old->sa_handler != SIG_DFL && old->sa_handler != SIG_IGN) {
+            old->sa_handler(sig);
+            return;
+        }
+    }
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+static uint64_t csc512project_ring_magic(void) {
+    uint64_t magic;
+    memcpy(&magic, "KPRING01", sizeof(magic));
+    return magic;
+}
+
+static uint64_t csc512project_ring_capacity(const char *events) {
+    uint64_t capacity = 1;
+    uint64_t requested = strtoull(events, NULL, 10);
+    while (capacity < requested && capacity < (1ULL << 40)) {
+        capacity <<= 1;
+    }
+    return capacity;
+}
+
+// Maps a ring of `capacity` slots from fd, initializing the header if `init`
+// is set. Returns NULL on failure.
+static struct csc512project_ring_header *csc512project_ring_map(int fd, uint64_t capacity, int init) {
+    size_t size = sizeof(struct csc512project_ring_header) + capacity * sizeof(struct csc512project_ring_slot);
+    if (init && ftruncate(fd, size) != 0) {
+        return NULL;
+    }
+    void *mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mapping == MAP_FAILED) {
+        return NULL;
+    }
+    struct csc512project_ring_header *header = mapping;
+    if (init) {
+        header->capacity = capacity;
+        header->pid = getpid();
+        // publish the magic last so attaching processes know the header is ready
+        __atomic_store_n((uint64_t *)header->magic, csc512project_ring_magic(), __ATOMIC_RELEASE);
+    }
+    return header;
+}
+
+static void csc512project_ring_open(uint64_t capacity) {
+    char name[64];
+    snprintf(name, sizeof(name), "branch_trace.ring.%d", (int)getpid());
+    int fd = open(name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return;
+    }
+    struct csc512project_ring_header *header = csc512project_ring_map(fd, capacity, 1);
+    close(fd);
+    if (!header) {
+        return;
+    }
+    csc512project_ring_slots = (struct csc512project_ring_slot *)(header + 1);
+    csc512project_ring = header;
+}
+
+static void csc512project_ring_install_handlers(void) {
+    atexit(csc512project_ring_exit);
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = csc512project_ring_signal;
+    action.sa_flags = SA_SIGINFO | SA_NODEFER | SA_RESETHAND;
+    sigemptyset(&action.sa_mask);
+    for (size_t i = 0; i < sizeof(csc512project_fatal_signals) / sizeof(int); i++) {
+        sigaction(csc512project_fatal_signals[i], &action, &csc512project_old_actions[i]);
+    }
+}
+
+// Shared memory mode: when KEYPOINTS_SHM is set to a name like /myservice, the
+// same kind of ring is placed in POSIX shared memory under that name so a
+// keypoints-live process can watch events as they happen. Every process and
+// thread started with the same name writes into the one ring. Writers never
+// wait for the reader; if it falls behind or isn't running, the oldest events
+// are overwritten. The size comes from KEYPOINTS_SHM_EVENTS, or 1M events.
+static void csc512project_shm_open(const char *shm_name) {
+    const char *events = getenv("KEYPOINTS_SHM_EVENTS");
+    uint64_t capacity = csc512project_ring_capacity(events && *events ? events : "1048576");
+    struct csc512project_ring_header *header = NULL;
+    // whichever process creates the segment sets it up, the rest attach
+    int fd = shm_open(shm_name, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd >= 0) {
+        header = csc512project_ring_map(fd, capacity, 1);
+    } else if ((fd = shm_open(shm_name, O_RDWR, 0)) >= 0) {
+        struct csc512project_ring_header probe;
+        // wait briefly for the creator to publish the header
+        for (int tries = 0; tries < 1000; tries++) {
+            if (pread(fd, &probe, sizeof(probe), 0) == sizeof(probe) &&
+                __atomic_load_n((uint64_t *)probe.magic, __ATOMIC_ACQUIRE) == csc512project_ring_magic()) {
+                header = csc512project_ring_map(fd, probe.capacity, 0);
+                break;
+            }
+            usleep(1000);
+        }
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    if (header) {
+        csc512project_ring_slots = (struct csc512project_ring_slot *)(header + 1);
+        csc512project_ring = header;
+    }
+}
+
+// Function pointers are logged relative to the ELF object (the executable or a
+// shared library) containing them, so they mean the same thing in every run
+// despite ASLR. Object 0 is the executable, whose offsets are its link-time
+// addresses and are written as func_0x{offset}; other objects are written as
+// func_0x{offset}@{object}. Before the first function pointer is logged, the
+// objects are listed in branch_objects.{pid}.txt as `{object} 0x{bias} {path}`,
+// which keypoints-symbolize uses to turn the offsets into names and lines.
+#define CSC512PROJECT_UNKNOWN_OBJECT 0x7fff
+
+struct csc512project_object {
+    uintptr_t bias;
+    // range of the object's executable segments
+    uintptr_t start;
+    uintptr_t end;
+    char path[256];
+};
+
+struct csc512project_objects {
+    int count;
+    struct csc512project_object objects[];
+};
+
+static struct csc512project_objects *csc512project_objects;
+static int csc512project_objects_written;
+static pthread_mutex_t csc512project_objects_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int csc512project_add_object(struct dl_phdr_info *info, size_t size, void *data) {
+    (void)size;
+    struct csc512project_objects *all = data;
+    struct csc512project_object o = {info->dlpi_addr, UINTPTR_MAX, 0, ""};
+    for (int i = 0; i < info->dlpi_phnum; i++) {
+        const ElfW(Phdr) *ph = &info->dlpi_phdr[i];
+        if (ph->p_type == PT_LOAD && (ph->p_flags & PF_X)) {
+            uintptr_t start = info->dlpi_addr + ph->p_vaddr;
+            o.start = start < o.start ? start : o.start;
+            o.end = start + ph->p_memsz > o.end ? start + ph->p_memsz : o.end;
+        }
+    }
+    if (o.start >= o.end) {
+        return 0;
+    }
+    if (info->dlpi_name && *info->dlpi_name) {
+        snprintf(o.path, sizeof(o.path), "%s", info->dlpi_name);
+    } else if (all->count == 0) {
+        // the executable comes first and has no name
+        ssize_t n = readlink("/proc/self/exe", o.path, sizeof(o.path) - 1);
+        o.path[n > 0 ? n : 0] = '\0';
+    }
+    // objects already known keep their number
+    for (int i = 0; i < all->count; i++) {
+        if (all->objects[i].bias == o.bias && all->objects[i].start == o.start) {
+            return 0;
+        }
+    }
+    if (all->count < CSC512PROJECT_UNKNOWN_OBJECT) {
+        all->objects[all->count++] = o;
+    }
+    return 0;
+}
+
+static int csc512project_count_objects(struct dl_phdr_info *info, size_t size, void *data) {
+    (void)info;
+    (void)size;
+    (*(int *)data)++;
+    return 0;
+}
+
+// Rebuilds the object list, e.g. after a dlopen(). Called with the lock held.
+static void csc512project_scan_objects(void) {
+    struct csc512project_objects *old = csc512project_objects;
+    int max = old ? old->count : 0;
+    dl_iterate_phdr(csc512project_count_objects, &max);
+    struct csc512project_objects *all = malloc(sizeof(*all) + max * sizeof(struct csc512project_object));
+    if (!all) {
+        return;
+    }
+    all->count = 0;
+    if (old) {
+        memcpy(all->objects, old->objects, old->count * sizeof(struct csc512project_object));
+        all->count = old->count;
+    }
+    dl_iterate_phdr(csc512project_add_object, all);
+    // the old list is leaked since other threads may still be reading it
+    __atomic_store_n(&csc512project_objects, all, __ATOMIC_RELEASE);
+}
+
+static void csc512project_write_objects(void) {
+    struct csc512project_objects *all = csc512project_objects;
+    char name[64];
+    snprintf(name, sizeof(name), "branch_objects.%d.txt", (int)getpid());
+    FILE *f = fopen(name, "w");
+    if (!f || !all) {
+        if (f) {
+            fclose(f);
+        }
+        return;
+    }
+    for (int i = 0; i < all->count; i++) {
+        fprintf(f, "%d 0x%lx %s\n", i, (unsigned long)all->objects[i].bias, all->objects[i].path);
+    }
+    fclose(f);
+}
+
+static int csc512project_find_object(struct csc512project_objects *all, uintptr_t addr) {
+    for (int i = 0; all && i < all->count; i++) {
+        if (addr >= all->objects[i].start && addr < all->objects[i].end) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Splits a function pointer into an object number and offset.
+static int csc512project_locate(void *fp, uint64_t *offset) {
+    uintptr_t addr = (uintptr_t)fp;
+    struct csc512project_objects *all = __atomic_load_n(&csc512project_objects, __ATOMIC_ACQUIRE);
+    int object = csc512project_find_object(all, addr);
+    if (object < 0 || !__atomic_load_n(&csc512project_objects_written, __ATOMIC_ACQUIRE)) {
+        pthread_mutex_lock(&csc512project_objects_lock);
+        if (object < 0) {
+            csc512project_scan_objects();
+            all = csc512project_objects;
+            object = csc512project_find_object(all, addr);
+        }
+        if (object >= 0 || !csc512project_objects_written) {
+            csc512project_write_objects();
+            __atomic_store_n(&csc512project_objects_written, 1, __ATOMIC_RELEASE);
+        }
+        pthread_mutex_unlock(&csc512project_objects_lock);
+    }
+    if (object < 0) {
+        *offset = addr;
+        return CSC512PROJECT_UNKNOWN_OBJECT;
+    }
+    *offset = addr - all->objects[object].bias;
+    return object;
+}
+
+static void csc512project_format_fp(char *buf, size_t size, void *fp) {
+    uint64_t offset;
+    int object = csc512project_locate(fp, &offset);
+    if (object == 0) {
+        snprintf(buf, size, "func_0x%llx", (unsigned long long)offset);
+    } else if (object == CSC512PROJECT_UNKNOWN_OBJECT) {
+        // not in any object, so the raw address
+        snprintf(buf, size, "func_0x%llx@?", (unsigned long long)offset);
+    } else {
+        snprintf(buf, size, "func_0x%llx@%d", (unsigned long long)offset, object);
+    }
+}
+
+// Path mode: the tags a function invocation logs between two calls, or between
+// a call and its return, form a segment. Most segments repeat one of a few
+// sequences, so each distinct sequence is stored once in a path table and the
+// stream only records which path ran. The stream, branch_paths.{pid}.bin
+// (branch_paths.{pid}.{n}.bin after an exec that kept the pid), is
+// the magic "KPPATHS1" followed by 32-bit records: a path number, or
+// CSC512PROJECT_PATH_FP followed by a 64-bit function pointer event encoded as
+// in the ring, or CSC512PROJECT_PATH_LITERAL followed by a count and that many
+// tags for segments that didn't fit in the table. The table is written to
+// the matching .txt at exit as `path_N: function hash tag...`, where
+// function is the first tag ID of the function. keypoints-paths reads both
+// and expands them back into the trace; keep it in sync.
+#define CSC512PROJECT_SEGMENT_MAX 4096
+#define CSC512PROJECT_PATH_SLOTS (1 << 20)
+#define CSC512PROJECT_PATH_FP 0xffffffffu
+#define CSC512PROJECT_PATH_LITERAL 0xfffffffeu
+
+struct csc512project_path {
+    // 0 for an empty slot
+    uint64_t hash;
+    uint32_t index;
+    int32_t function;
+    uint32_t length;
+    uint32_t *tags;
+};
+
+static struct csc512project_path *csc512project_paths;
+static struct csc512project_path **csc512project_paths_by_index;
+static uint32_t csc512project_num_paths;
+static FILE *csc512project_path_stream;
+static char csc512project_path_name[64];
+static pthread_mutex_t csc512project_paths_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static __thread uint32_t csc512project_segment[CSC512PROJECT_SEGMENT_MAX];
+static __thread uint32_t csc512project_segment_length;
+static __thread int32_t csc512project_segment_function;
+static __thread uint64_t csc512project_segment_hash;
+
+// Opens the stream and allocates the table on first use. Called with the lock held.
+static int csc512project_paths_open(void) {
+    if (csc512project_path_stream) {
+        return 1;
+    }
+    if (!csc512project_paths) {
+        csc512project_paths = calloc(CSC512PROJECT_PATH_SLOTS, sizeof(struct csc512project_path));
+        csc512project_paths_by_index = calloc(CSC512PROJECT_PATH_SLOTS / 2, sizeof(struct csc512project_path *));
+        if (!csc512project_paths || !csc512project_paths_by_index) {
+            return 0;
+        }
+    }
+    // an exec keeps the pid but starts a new table, so it gets its own files
+    FILE *f = NULL;
+    for (int n = 0; !f && n < 100; n++) {
+        if (n == 0) {
+            snprintf(csc512project_path_name, sizeof(csc512project_path_name), "branch_paths.%d", (int)getpid());
+        } else {
+            snprintf(csc512project_path_name, sizeof(csc512project_path_name), "branch_paths.%d.%d", (int)getpid(), n);
+        }
+        char name[80];
+        snprintf(name, sizeof(name), "%s.bin", csc512project_path_name);
+        int fd = open(name, O_WRONLY | O_CREAT | O_EXCL, 0644);
+        if (fd >= 0) {
+            f = fdopen(fd, "wb");
+        } else if (errno != EEXIST) {
+            return 0;
+        }
+    }
+    if (!f) {
+        return 0;
+    }
+    setvbuf(f, NULL, _IOFBF, 1 << 20);
+    fwrite("KPPATHS1", 8, 1, f);
+    csc512project_path_stream = f;
+    return 1;
+}
+
+// Finds or adds the path, returning its number or CSC512PROJECT_PATH_LITERAL
+// if the table is full. Called with the lock held.
+static uint32_t csc512project_path_number(int32_t function, uint64_t hash, const uint32_t *tags, uint32_t length) {
+    for (uint64_t i = hash;; i++) {
+        struct csc512project_path *p = &csc512project_paths[i & (CSC512PROJECT_PATH_SLOTS - 1)];
+        if (p->hash == 0) {
+            // keep the table at most half full so probing stays short
+            if (csc512project_num_paths >= CSC512PROJECT_PATH_SLOTS / 2) {
+                return CSC512PROJECT_PATH_LITERAL;
+            }
+            uint32_t *copy = malloc(length * sizeof(uint32_t));
+            if (!copy) {
+                return CSC512PROJECT_PATH_LITERAL;
+            }
+            memcpy(copy, tags, length * sizeof(uint32_t));
+            p->hash = hash;
+            p->index = csc512project_num_paths++;
+            p->function = function;
+            p->length = length;
+            p->tags = copy;
+            csc512project_paths_by_index[p->index] = p;
+            return p->index;
+        }
+        // compare the tags too so a hash collision can't corrupt the trace
+        if (p->hash == hash && p->function == function && p->length == length &&
+            memcmp(p->tags, tags, length * sizeof(uint32_t)) == 0) {
+            return p->index;
+        }
+    }
+}
+
+void csc512project_path_flush(void) {
+    uint32_t length = csc512project_segment_length;
+    if (length == 0) {
+        return;
+    }
+    csc512project_segment_length = 0;
+    pthread_mutex_lock(&csc512project_paths_lock);
+    if (csc512project_paths_open()) {
+        uint32_t number = csc512project_path_number(csc512project_segment_function, csc512project_segment_hash,
+            csc512project_segment, length);
+        fwrite_unlocked(&number, sizeof(number), 1, csc512project_path_stream);
+        if (number == CSC512PROJECT_PATH_LITERAL) {
+            fwrite_unlocked(&length, sizeof(length), 1, csc512project_path_stream);
+            fwrite_unlocked(csc512project_segment, sizeof(uint32_t), length, csc512project_path_stream);
+        }
+    }
+    pthread_mutex_unlock(&csc512project_paths_lock);
+}
+
+void csc512project_path_branch(int function, int br_tag) {
+    if (csc512project_segment_length == CSC512PROJECT_SEGMENT_MAX ||
+        (csc512project_segment_length > 0 && csc512project_segment_function != function)) {
+        // a long loop without calls, or a segment the pass couldn't end, e.g. after a longjmp
+        csc512project_path_flush();
+    }
+    if (csc512project_segment_length == 0) {
+        csc512project_segment_function = function;
+        csc512project_segment_hash = 14695981039346656037ULL ^ (uint32_t)function;
+    }
+    csc512project_segment[csc512project_segment_length++] = br_tag;
+    csc512project_segment_hash = (csc512project_segment_hash ^ (uint32_t)br_tag) * 1099511628211ULL;
+    if (csc512project_segment_hash == 0) {
+        csc512project_segment_hash = 1;
+    }
+}
+
+void csc512project_path_fp(void *fp) {
+    csc512project_path_flush();
+    uint64_t offset;
+    uint64_t object = csc512project_locate(fp, &offset);
+    uint64_t event = CSC512PROJECT_RING_FP | object << CSC512PROJECT_RING_OBJECT_SHIFT | (offset & CSC512PROJECT_RING_OFFSET_MASK);
+    uint32_t marker = CSC512PROJECT_PATH_FP;
+    pthread_mutex_lock(&csc512project_paths_lock);
+    if (csc512project_paths_open()) {
+        fwrite_unlocked(&marker, sizeof(marker), 1, csc512project_path_stream);
+        fwrite_unlocked(&event, sizeof(event), 1, csc512project_path_stream);
+    }
+    pthread_mutex_unlock(&csc512project_paths_lock);
+}
+
+static void csc512project_dump_paths(void) {
+    // the exiting thread may be in the middle of a segment, e.g. when main returns
+    csc512project_path_flush();
+    pthread_mutex_lock(&csc512project_paths_lock);
+    if (csc512project_path_stream) {
+        fflush(csc512project_path_stream);
+        char name[80];
+        snprintf(name, sizeof(name), "%s.txt", csc512project_path_name);
+        FILE *f = fopen(name, "w");
+        if (f) {
+            for (uint32_t i = 0; i < csc512project_num_paths; i++) {
+                struct csc512project_path *p = csc512project_paths_by_index[i];
+                fprintf(f, "path_%u: %d %016llx", p->index, p->function, (unsigned long long)p->hash);
+                for (uint32_t t = 0; t < p->length; t++) {
+                    fprintf(f, " %u", p->tags[t]);
+                }
+                fprintf(f, "\n");
+            }
+            fclose(f);
+        }
+    }
+    pthread_mutex_unlock(&csc512project_paths_lock);
+}
+
+// Per-process mode: when KEYPOINTS_PER_PROCESS is set, each process writes its
+// own buffered trace, branch_trace.{run}.{pid}.txt, instead of appending to
+// branch_trace.txt one event at a time. The run is taken from KEYPOINTS_RUN, or
+// made up by the first traced process and passed on to everything it starts,
+// so all the traces of one process tree share it. The trace starts with
+// comment lines naming the process's nearest traced ancestor and whether the
+// process was forked from it or started with exec. When a process execs
+// another instrumented program, the new program appends to the same trace.
+static FILE *csc512project_trace;
+static char csc512project_run[64];
+static int csc512project_is_shm;
+
+static void csc512project_trace_open(const char *parent, const char *origin) {
+    char pid[16];
+    snprintf(pid, sizeof(pid), "%d", (int)getpid());
+    char name[128];
+    snprintf(name, sizeof(name), "branch_trace.%s.%s.txt", csc512project_run, pid);
+    // a process that execs keeps its pid, so the new image continues its trace
+    int same_process = strcmp(parent, pid) == 0;
+    FILE *f = fopen(name, same_process ? "a" : "w");
+    if (!f) {
+        return;
+    }
+    setvbuf(f, NULL, _IOFBF, 1 << 20);
+    if (same_process) {
+        fprintf(f, "# exec\n");
+    } else {
+        fprintf(f, "# pid: %s\n# parent: %s\n# origin: %s\n# run: %s\n", pid, parent, origin, csc512project_run);
+    }
+    csc512project_trace = f;
+    // processes we exec find their parent here
+    setenv("KEYPOINTS_PARENT", pid, 1);
+}
+
+// Writes out the buffered trace. The pass calls this before exec and _exit,
+// which would otherwise throw the buffer away.
+void csc512project_flush_trace(void) {
+    if (csc512project_trace) {
+        fflush(csc512project_trace);
+    }
+    // a path stream is useless without its table
+    csc512project_dump_paths();
+}
+
+// fork() copies the trace buffer, counters and timings into the child, so the
+// buffer is emptied beforehand and the child starts everything from zero.
+static void csc512project_before_fork(void) {
+    // taken first: a thread holding it may still go on to write the trace
+    pthread_mutex_lock(&csc512project_objects_lock);
+    if (csc512project_trace) {
+        // holding the lock also keeps other threads from filling the buffer again
+        flockfile(csc512project_trace);
+        fflush(csc512project_trace);
+    }
+    pthread_mutex_lock(&csc512project_paths_lock);
+    if (csc512project_path_stream) {
+        fflush(csc512project_path_stream);
+    }
+}
+
+static void csc512project_after_fork_parent(void) {
+    if (csc512project_trace) {
+        funlockfile(csc512project_trace);
+    }
+    pthread_mutex_unlock(&csc512project_paths_lock);
+    pthread_mutex_unlock(&csc512project_objects_lock);
+}
+
+static void csc512project_after_fork_child(void) {
+    pthread_mutex_unlock(&csc512project_paths_lock);
+    // the child writes its own object list on its first function pointer
+    pthread_mutex_unlock(&csc512project_objects_lock);
+    if (csc512project_path_stream) {
+        // the child keeps the parent's table, so its stream can refer to the
+        // same path numbers, but records its own runs in its own stream
+        fclose(csc512project_path_stream);
+        csc512project_path_stream = NULL;
+    }
+    if (csc512project_trace) {
+        funlockfile(csc512project_trace);
+        fclose(csc512project_trace);
+        csc512project_trace = NULL;
+        char parent[16];
+        snprintf(parent, sizeof(parent), "%d", (int)getppid());
+        csc512project_trace_open(parent, "fork");
+    }
+    if (csc512project_ring && !csc512project_is_shm) {
+        // the parent's ring is its own; the child gets one of the same size
+        uint64_t capacity = csc512project_ring->capacity;
+        munmap(csc512project_ring, sizeof(struct csc512project_ring_header) + capacity * sizeof(struct csc512project_ring_slot));
+        csc512project_ring = NULL;
+        csc512project_ring_open(capacity);
+    }
+    for (int i = 0; i < csc512project_num_modules; i++) {
+        struct csc512project_module *m = &csc512project_modules[i];
+        if (m->counters) {
+            memset(m->counters, 0, m->count * sizeof(uint64_t));
+        }
+    }
+    if (csc512project_timings) {
+        memset(csc512project_timings, 0, csc512project_num_timings * sizeof(*csc512project_timings));
+    }
+    csc512project_last_tag = -1;
+    // the child lists the same objects under its own pid
+    csc512project_objects_written = 0;
+}
+
+static int csc512project_env_set(const char *name) {
+    const char *value = getenv(name);
+    return value && *value && strcmp(value, "0") != 0;
+}
+
+__attribute__((constructor)) static void csc512project_init(void) {
+    const char *shm_name = getenv("KEYPOINTS_SHM");
+    const char *ring = getenv("KEYPOINTS_RING");
+    if (shm_name && *shm_name) {
+        csc512project_shm_open(shm_name);
+        csc512project_is_shm = 1;
+    } else if (ring && *ring) {
+        csc512project_ring_open(csc512project_ring_capacity(ring));
+        if (csc512project_ring) {
+            csc512project_ring_install_handlers();
+        }
+    } else if (csc512project_env_set("KEYPOINTS_PER_PROCESS")) {
+        const char *run = getenv("KEYPOINTS_RUN");
+        if (run && *run) {
+            snprintf(csc512project_run, sizeof(csc512project_run), "%s", run);
+        } else {
+            snprintf(csc512project_run, sizeof(csc512project_run), "%lx-%d", (unsigned long)time(NULL), (int)getpid());
+            setenv("KEYPOINTS_RUN", csc512project_run, 1);
+        }
+        const char *parent = getenv("KEYPOINTS_PARENT");
+        csc512project_trace_open(parent ? parent : "none", parent ? "exec" : "start");
+    }
+    pthread_mutex_lock(&csc512project_objects_lock);
+    csc512project_scan_objects();
+    pthread_mutex_unlock(&csc512project_objects_lock);
+    pthread_atfork(csc512project_before_fork, csc512project_after_fork_parent, csc512project_after_fork_child);
+}
 
 void csc512project_log_branch(int br_tag) {
+    if (csc512project_ring) {
+        csc512project_ring_push((uint32_t)br_tag);
+        return;
+    }
+    if (csc512project_trace) {
+        fprintf(csc512project_trace, "br_%d\n", br_tag);
+        return;
+    }
     FILE *f = fopen("branch_trace.txt", "a");
     fprintf(f, "br_%d\n", br_tag);
     fclose(f);
 }
 
 void csc512project_log_fp(void *fp) {
+    if (csc512project_ring) {
+        uint64_t offset;
+        uint64_t object = csc512project_locate(fp, &offset);
+        csc512project_ring_push(CSC512PROJECT_RING_FP | object << CSC512PROJECT_RING_OBJECT_SHIFT | (offset & CSC512PROJECT_RING_OFFSET_MASK));
+        return;
+    }
+    char event[64];
+    csc512project_format_fp(event, sizeof(event), fp);
+    if (csc512project_trace) {
+        fprintf(csc512project_trace, "%s\n", event);
+        return;
+    }
     FILE *f = fopen("branch_trace.txt", "a");
-    // cast to get rid of warnings and use long since just int might lose precision
-    fprintf(f, "func_0x%lx\n", (long int)fp);
+    fprintf(f, "%s\n", event);
     fclose(f);
-}
\ No newline at end of file
+}
@@ -0,0 +1,40 @@
+#include "Counters.h"
+#include <cstdio>
+#include <cstring>
+
+namespace keypoints {
+
+bool CounterDump::open(const std::string &path, std::string &error) {
+    auto file = llvm::MemoryBuffer::getFile(path, /*IsText=*/false, /*RequiresNullTerminator=*/false);
+    if (!file) {
+        error = file.getError().message();
+        return false;
+    }
+    buffer = std::move(*file);
+    if (buffer->getBufferSize() < sizeof(CounterHeader) || memcmp(header().magic, CounterMagic, sizeof(CounterMagic)) != 0) {
+        error = "not a counter dump";
+        return false;
+    }
+    if (buffer->getBufferSize() != sizeof(CounterHeader) + header().num_counters * sizeof(uint64_t)) {
+        error = "truncated counter dump";
+        return false;
+    }
+    return true;
+}
+
+bool writeCounterDump(const std::string &path, uint64_t dictionaryHash, uint64_t runs, const std::vector<uint64_t> &counters) {
+    FILE *f = fopen(path.c_str(), "wb");
+    if (!f) {
+        return false;
+    }
+    CounterHeader header;
+    memcpy(header.magic, CounterMagic, sizeof(CounterMagic));
+    header.dictionary_hash = dictionaryHash;
+    header.num_counters = counters.size();
+    header.runs = runs;
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+        fwrite(counters.data(), sizeof(uint64_t), counters.size(), f) == counters.size();
+    return fclose(f) == 0 && ok;
+}
+
+}
@@ -0,0 +1,42 @@
+// Counter dumps written by instrumented programs built with
+// -keypoints-mode=counter, and by keypoints-merge.
+#ifndef KEYPOINTS_TOOLS_COUNTERS_H
+#define KEYPOINTS_TOOLS_COUNTERS_H
+
+#include "llvm/Support/MemoryBuffer.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace keypoints {
+
+// Must match csc512project_counter_header in branchlog.c.
+struct CounterHeader {
+    char magic[8];
+    uint64_t dictionary_hash;
+    uint64_t num_counters;
+    uint64_t runs;
+};
+
+constexpr char CounterMagic[8] = {'K', 'P', 'C', 'O', 'U', 'N', 'T', '1'};
+
+// A dump mapped into memory rather than read, so opening thousands of them is
+// cheap and only the pages that get summed are touched.
+class CounterDump {
+    public:
+    // On failure returns false and sets `error`.
+    bool open(const std::string &path, std::string &error);
+
+    const CounterHeader &header() const { return *reinterpret_cast<const CounterHeader *>(buffer->getBufferStart()); }
+    const uint64_t *counters() const { return reinterpret_cast<const uint64_t *>(buffer->getBufferStart() + sizeof(CounterHeader)); }
+
+    private:
+    std::unique_ptr<llvm::MemoryBuffer> buffer;
+};
+
+bool writeCounterDump(const std::string &path, uint64_t dictionaryHash, uint64_t runs, const std::vector<uint64_t> &counters);
+
+}
+
+#endif
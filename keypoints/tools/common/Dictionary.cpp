@@ -0,0 +1,83 @@
+#include "Dictionary.h"
+#include <cstdlib>
+#include <fstream>
+
+namespace keypoints {
+
+static bool parseInt(const std::string &s, int &out) {
+    char *end = nullptr;
+    auto v = std::strtol(s.c_str(), &end, 10);
+    if (s.empty() || *end != '\0') {
+        return false;
+    }
+    out = (int)v;
+    return true;
+}
+
+uint64_t hashDictionaryLine(const std::string &line) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (unsigned char c : line) {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+bool Dictionary::load(const std::string &path) {
+    std::ifstream in(path);
+    if (!in) {
+        return false;
+    }
+    std::string line;
+    while (std::getline(in, line)) {
+        // br_N: file, condition_line, block_start_line
+        if (line.compare(0, 3, "br_") != 0) {
+            continue;
+        }
+        auto colon = line.find(": ");
+        auto last = line.rfind(", ");
+        if (colon == std::string::npos || last == std::string::npos || last <= colon) {
+            continue;
+        }
+        auto middle = line.rfind(", ", last - 1);
+        if (middle == std::string::npos || middle <= colon) {
+            continue;
+        }
+        DictionaryEntry E;
+        if (!parseInt(line.substr(3, colon - 3), E.id) ||
+            !parseInt(line.substr(middle + 2, last - middle - 2), E.condition_line) ||
+            !parseInt(line.substr(last + 2), E.block_start_line) ||
+            E.id < 0) {
+            continue;
+        }
+        // the file name is everything between the tag and the line numbers so
+        // paths containing ", " still round trip
+        E.file_name = line.substr(colon + 2, middle - colon - 2);
+        if ((size_t)E.id >= byId.size()) {
+            byId.resize(E.id + 1);
+        }
+        if (!byId[E.id].valid()) {
+            count++;
+        }
+        dictionaryHash += hashDictionaryLine(line);
+        byId[E.id] = E;
+    }
+    return true;
+}
+
+const DictionaryEntry *Dictionary::lookup(int id) const {
+    if (id < 0 || (size_t)id >= byId.size() || !byId[id].valid()) {
+        return nullptr;
+    }
+    return &byId[id];
+}
+
+std::string Dictionary::location(int id) const {
+    auto E = lookup(id);
+    if (!E) {
+        return "";
+    }
+    return E->file_name + ":" + std::to_string(E->condition_line);
+}
+
+}
@@ -0,0 +1,45 @@
+// Reader for the branch_dictionary.txt files written by the KeyPoints pass.
+#ifndef KEYPOINTS_TOOLS_DICTIONARY_H
+#define KEYPOINTS_TOOLS_DICTIONARY_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace keypoints {
+
+uint64_t hashDictionaryLine(const std::string &line);
+
+struct DictionaryEntry {
+    int id = -1;
+    std::string file_name;
+    int condition_line = -1;
+    int block_start_line = -1;
+
+    bool valid() const { return id >= 0; }
+};
+
+class Dictionary {
+    public:
+    // Parses `br_N: file, condition_line, block_start_line` lines. Lines that
+    // don't match are skipped so a dictionary with stray output still loads.
+    bool load(const std::string &path);
+
+    const DictionaryEntry *lookup(int id) const;
+    // Formats an entry as `file:condition_line` or an empty string if unknown.
+    std::string location(int id) const;
+    size_t size() const { return count; }
+    // Same value the pass registers with the runtime: the sum of the FNV-1a
+    // hashes of every dictionary line.
+    uint64_t hash() const { return dictionaryHash; }
+    const std::vector<DictionaryEntry> &entries() const { return byId; }
+
+    private:
+    std::vector<DictionaryEntry> byId;
+    size_t count = 0;
+    uint64_t dictionaryHash = 0;
+};
+
+}
+
+#endif
@@ -0,0 +1,46 @@
+#include "Paths.h"
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+namespace keypoints {
+
+bool PathTable::load(const std::string &path, std::string &error) {
+    std::ifstream in(path);
+    if (!in) {
+        error = "unable to open";
+        return false;
+    }
+    std::string line;
+    size_t lineNumber = 0;
+    while (std::getline(in, line)) {
+        lineNumber++;
+        char *end = nullptr;
+        uint32_t number = line.compare(0, 5, "path_") == 0 ? strtoul(line.c_str() + 5, &end, 10) : 0;
+        if (!end || *end != ':') {
+            error = "line " + std::to_string(lineNumber) + " is not a path";
+            return false;
+        }
+        // the runtime writes paths in order, so the numbers are just a check
+        if (number != paths.size()) {
+            error = "line " + std::to_string(lineNumber) + " is out of order";
+            return false;
+        }
+        std::istringstream fields(end + 1);
+        Path P;
+        std::string hash;
+        if (!(fields >> P.function >> hash)) {
+            error = "line " + std::to_string(lineNumber) + " is truncated";
+            return false;
+        }
+        P.hash = strtoull(hash.c_str(), nullptr, 16);
+        uint32_t tag;
+        while (fields >> tag) {
+            P.tags.push_back(tag);
+        }
+        paths.push_back(std::move(P));
+    }
+    return true;
+}
+
+}
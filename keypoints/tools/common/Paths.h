@@ -0,0 +1,42 @@
+// Path streams and tables written by instrumented programs built with
+// -keypoints-mode=path.
+#ifndef KEYPOINTS_TOOLS_PATHS_H
+#define KEYPOINTS_TOOLS_PATHS_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace keypoints {
+
+// Must match the CSC512PROJECT_PATH_* records in branchlog.c. The stream
+// starts with PathMagic and is followed by 32-bit path numbers, except that
+// PathFunctionPointer is followed by a 64-bit ring-style event and PathLiteral
+// by a count and that many tags.
+constexpr char PathMagic[8] = {'K', 'P', 'P', 'A', 'T', 'H', 'S', '1'};
+constexpr uint32_t PathFunctionPointer = 0xffffffff;
+constexpr uint32_t PathLiteral = 0xfffffffe;
+
+struct Path {
+    // first tag ID of the function the path ran in
+    int function = -1;
+    uint64_t hash = 0;
+    std::vector<uint32_t> tags;
+};
+
+class PathTable {
+    public:
+    // Parses `path_N: function hash tag...` lines. On failure returns false
+    // and sets `error`.
+    bool load(const std::string &path, std::string &error);
+
+    const Path *lookup(uint32_t number) const { return number < paths.size() ? &paths[number] : nullptr; }
+    size_t size() const { return paths.size(); }
+
+    private:
+    std::vector<Path> paths;
+};
+
+}
+
+#endif
@@ -0,0 +1,41 @@
+#include "Ring.h"
+#include <cstdio>
+
+namespace keypoints {
+
+std::string formatRingEvent(uint64_t event) {
+    char buf[32];
+    if (event & RingFunctionPointer) {
+        auto object = (unsigned)((event & ~RingFunctionPointer) >> RingObjectShift);
+        auto offset = (unsigned long long)(event & RingOffsetMask);
+        if (object == 0) {
+            snprintf(buf, sizeof(buf), "func_0x%llx", offset);
+        } else if (object == RingUnknownObject) {
+            snprintf(buf, sizeof(buf), "func_0x%llx@?", offset);
+        } else {
+            snprintf(buf, sizeof(buf), "func_0x%llx@%u", offset, object);
+        }
+    } else {
+        snprintf(buf, sizeof(buf), "br_%llu", (unsigned long long)event);
+    }
+    return buf;
+}
+
+bool readRingSlot(const RingSlot *slots, uint64_t capacity, uint64_t pos, uint64_t &event) {
+    auto &slot = slots[pos & (capacity - 1)];
+    // the writer marks the slot busy before storing the event and publishes
+    // its sequence number after, so seeing the same finished sequence number
+    // before and after means the event is whole and from that writer
+    auto before = __atomic_load_n(&slot.seq, __ATOMIC_ACQUIRE);
+    event = __atomic_load_n(&slot.event, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    auto after = __atomic_load_n(&slot.seq, __ATOMIC_RELAXED);
+    return before == pos + 1 && after == before;
+}
+
+bool ringSlotPending(const RingSlot *slots, uint64_t capacity, uint64_t pos) {
+    auto seq = __atomic_load_n(&slots[pos & (capacity - 1)].seq, __ATOMIC_ACQUIRE);
+    return seq == ((pos + 1) | RingBusy) || (!(seq & RingBusy) && seq < pos + 1);
+}
+
+}
@@ -0,0 +1,55 @@
+// Layout of the trace ring buffers the runtime writes in ring mode.
+#ifndef KEYPOINTS_TOOLS_RING_H
+#define KEYPOINTS_TOOLS_RING_H
+
+#include <cstdint>
+#include <string>
+
+namespace keypoints {
+
+// Must match csc512project_ring_header in branchlog.c.
+struct RingHeader {
+    char magic[8];
+    uint64_t capacity;
+    uint64_t head;
+    uint32_t state;
+    int32_t signal;
+    uint64_t pid;
+    uint64_t reserved[3];
+};
+
+// Must match csc512project_ring_slot in branchlog.c.
+struct RingSlot {
+    uint64_t seq;
+    uint64_t event;
+};
+
+// Set in RingSlot::seq while a writer fills the slot.
+constexpr uint64_t RingBusy = 1ULL << 63;
+
+constexpr char RingMagic[8] = {'K', 'P', 'R', 'I', 'N', 'G', '0', '1'};
+
+enum RingState : uint32_t { RingOpen = 0, RingExited = 1, RingSignaled = 2 };
+
+constexpr uint64_t RingFunctionPointer = 1ULL << 63;
+// Function pointer events hold the number of the object containing the
+// pointer above RingObjectShift and the offset into it below.
+constexpr unsigned RingObjectShift = 48;
+constexpr uint64_t RingOffsetMask = (1ULL << RingObjectShift) - 1;
+constexpr unsigned RingUnknownObject = 0x7fff;
+
+// Formats an event the way branch_trace.txt would have it.
+std::string formatRingEvent(uint64_t event);
+
+// Reads slot `pos` of a ring that may still be written to. Returns false if the
+// slot doesn't hold event `pos`, because it was overwritten, is mid-write, or
+// was never written.
+bool readRingSlot(const RingSlot *slots, uint64_t capacity, uint64_t pos, uint64_t &event);
+
+// Whether slot `pos` of a ring that may still be written to could yet get
+// event `pos`: its writer hasn't claimed it yet or is filling it.
+bool ringSlotPending(const RingSlot *slots, uint64_t capacity, uint64_t pos);
+
+}
+
+#endif
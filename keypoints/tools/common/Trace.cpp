@@ -0,0 +1,60 @@
+#include "Trace.h"
+#include <cstdlib>
+
+namespace keypoints {
+
+void parseTraceLine(const std::string &line, TraceEvent &E) {
+    E.text = line;
+    E.id = -1;
+    if (line.compare(0, 3, "br_") == 0) {
+        char *end = nullptr;
+        auto id = std::strtoll(line.c_str() + 3, &end, 10);
+        if (end != line.c_str() + 3 && *end == '\0') {
+            E.kind = TraceEvent::Branch;
+            E.id = id;
+            return;
+        }
+    } else if (line.compare(0, 5, "func_") == 0) {
+        E.kind = TraceEvent::FunctionPointer;
+        return;
+    }
+    E.kind = TraceEvent::Other;
+}
+
+TraceReader::~TraceReader() {
+    if (f && f != stdin) {
+        fclose(f);
+    }
+}
+
+bool TraceReader::open(const std::string &path) {
+    f = path == "-" ? stdin : fopen(path.c_str(), "r");
+    if (!f) {
+        return false;
+    }
+    // a bigger buffer than the default noticeably helps on multi-GB traces
+    setvbuf(f, nullptr, _IOFBF, 1 << 20);
+    return true;
+}
+
+bool TraceReader::next(TraceEvent &E) {
+    std::string line;
+    while (true) {
+        line.clear();
+        int c;
+        while ((c = getc_unlocked(f)) != EOF && c != '\n') {
+            line.push_back((char)c);
+        }
+        if (c == EOF && line.empty()) {
+            return false;
+        }
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        parseTraceLine(line, E);
+        events++;
+        return true;
+    }
+}
+
+}
@@ -0,0 +1,45 @@
+// Streaming reader for branch traces. Traces can be far larger than memory,
+// so events are handed out one at a time from a fixed size read buffer.
+#ifndef KEYPOINTS_TOOLS_TRACE_H
+#define KEYPOINTS_TOOLS_TRACE_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+namespace keypoints {
+
+struct TraceEvent {
+    enum Kind { Branch, FunctionPointer, Other };
+    Kind kind = Other;
+    // branch ID for Branch events, unused otherwise
+    int64_t id = -1;
+    // the raw line without the trailing newline
+    std::string text;
+};
+
+class TraceReader {
+    public:
+    TraceReader() = default;
+    TraceReader(const TraceReader &) = delete;
+    TraceReader &operator=(const TraceReader &) = delete;
+    ~TraceReader();
+
+    // `-` reads from stdin.
+    bool open(const std::string &path);
+    // Returns false at end of trace. Comment lines starting with `#` are skipped.
+    bool next(TraceEvent &E);
+    // Number of events returned so far.
+    uint64_t position() const { return events; }
+
+    private:
+    FILE *f = nullptr;
+    uint64_t events = 0;
+};
+
+// Classifies a single trace line.
+void parseTraceLine(const std::string &line, TraceEvent &E);
+
+}
+
+#endif
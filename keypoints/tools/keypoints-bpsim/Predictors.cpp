@@ -0,0 +1,225 @@
+#include "Predictors.h"
+#include <array>
+
+namespace keypoints {
+
+namespace {
+
+class Bimodal : public Predictor {
+    public:
+    Bimodal(unsigned tableBits): counters(1u << tableBits, 2), mask((1u << tableBits) - 1) {}
+    std::string name() const override { return "bimodal"; }
+    bool predict(uint64_t pc) override { return counters[pc & mask] >= 2; }
+    void update(uint64_t pc, bool taken) override {
+        auto &c = counters[pc & mask];
+        if (taken && c < 3) {
+            c++;
+        } else if (!taken && c > 0) {
+            c--;
+        }
+    }
+
+    private:
+    std::vector<uint8_t> counters;
+    uint64_t mask;
+};
+
+class Gshare : public Predictor {
+    public:
+    Gshare(unsigned tableBits, unsigned historyBits):
+        counters(1u << tableBits, 2),
+        mask((1u << tableBits) - 1),
+        historyMask(historyBits >= 64 ? ~0ULL : (1ULL << historyBits) - 1)
+    {}
+    std::string name() const override { return "gshare"; }
+    bool predict(uint64_t pc) override { return counters[index(pc)] >= 2; }
+    void update(uint64_t pc, bool taken) override {
+        auto &c = counters[index(pc)];
+        if (taken && c < 3) {
+            c++;
+        } else if (!taken && c > 0) {
+            c--;
+        }
+        history = ((history << 1) | taken) & historyMask;
+    }
+
+    private:
+    uint64_t index(uint64_t pc) const { return (pc ^ history) & mask; }
+    std::vector<uint8_t> counters;
+    uint64_t mask;
+    uint64_t historyMask;
+    uint64_t history = 0;
+};
+
+// Global history long enough for the longest TAGE table, kept as a ring.
+class GlobalHistory {
+    public:
+    static constexpr unsigned Size = 1024;
+    void push(bool taken) {
+        head = (head + Size - 1) % Size;
+        bits[head] = taken;
+    }
+    // The i-th most recent outcome, 0 being the newest.
+    bool at(unsigned i) const { return bits[(head + i) % Size]; }
+
+    private:
+    std::array<bool, Size> bits{};
+    unsigned head = 0;
+};
+
+// Compresses the most recent `length` history bits into `width` bits and keeps
+// it up to date incrementally, as in Seznec's TAGE reference code.
+class FoldedHistory {
+    public:
+    FoldedHistory(unsigned length, unsigned width): length(length), width(width) {}
+    void update(const GlobalHistory &H) {
+        value = (value << 1) | H.at(0);
+        value ^= (uint64_t)H.at(length) << (length % width);
+        value ^= value >> width;
+        value &= (1ULL << width) - 1;
+    }
+    uint64_t get() const { return value; }
+
+    private:
+    unsigned length;
+    unsigned width;
+    uint64_t value = 0;
+};
+
+class Tage : public Predictor {
+    public:
+    static constexpr unsigned NumTables = 4;
+    static constexpr unsigned TagBits = 9;
+
+    Tage(unsigned tableBits): base(tableBits), tableBits(tableBits) {
+        static const unsigned lengths[NumTables] = {5, 15, 44, 130};
+        for (unsigned t = 0; t < NumTables; t++) {
+            tables[t].entries.resize(1u << tableBits);
+            tables[t].indexHistory = FoldedHistory(lengths[t], tableBits);
+            tables[t].tagHistory[0] = FoldedHistory(lengths[t], TagBits);
+            tables[t].tagHistory[1] = FoldedHistory(lengths[t], TagBits - 1);
+        }
+    }
+    std::string name() const override { return "tage"; }
+    bool predict(uint64_t pc) override {
+        provider = alternate = -1;
+        for (int t = NumTables - 1; t >= 0; t--) {
+            indices[t] = index(pc, t);
+            tags[t] = tag(pc, t);
+            if (tables[t].entries[indices[t]].tag == tags[t]) {
+                if (provider < 0) {
+                    provider = t;
+                } else if (alternate < 0) {
+                    alternate = t;
+                }
+            }
+        }
+        bool basePrediction = base.predict(pc);
+        alternatePrediction = alternate >= 0 ? entry(alternate).ctr >= 0 : basePrediction;
+        prediction = provider >= 0 ? entry(provider).ctr >= 0 : basePrediction;
+        return prediction;
+    }
+    void update(uint64_t pc, bool taken) override {
+        // allocate a longer history entry on a misprediction
+        if (prediction != taken && provider < (int)NumTables - 1) {
+            bool allocated = false;
+            for (unsigned t = provider + 1; t < NumTables; t++) {
+                auto &E = tables[t].entries[indices[t]];
+                if (E.useful == 0) {
+                    E.tag = tags[t];
+                    E.ctr = taken ? 0 : -1;
+                    allocated = true;
+                    break;
+                }
+            }
+            if (!allocated) {
+                for (unsigned t = provider + 1; t < NumTables; t++) {
+                    auto &E = tables[t].entries[indices[t]];
+                    if (E.useful > 0) {
+                        E.useful--;
+                    }
+                }
+            }
+        }
+        if (provider >= 0) {
+            auto &E = entry(provider);
+            if (prediction != alternatePrediction) {
+                if (prediction == taken && E.useful < 3) {
+                    E.useful++;
+                } else if (prediction != taken && E.useful > 0) {
+                    E.useful--;
+                }
+            }
+            if (taken && E.ctr < 3) {
+                E.ctr++;
+            } else if (!taken && E.ctr > -4) {
+                E.ctr--;
+            }
+        } else {
+            base.update(pc, taken);
+        }
+        // periodically age the useful bits so stale entries can be replaced
+        if (++branches % (1u << 18) == 0) {
+            for (auto &T : tables) {
+                for (auto &E : T.entries) {
+                    E.useful >>= 1;
+                }
+            }
+        }
+        history.push(taken);
+        for (auto &T : tables) {
+            T.indexHistory.update(history);
+            T.tagHistory[0].update(history);
+            T.tagHistory[1].update(history);
+        }
+    }
+
+    private:
+    struct Entry {
+        int8_t ctr = 0;
+        // wider than any real tag so empty entries never match
+        uint16_t tag = 0xffff;
+        uint8_t useful = 0;
+    };
+    struct Table {
+        std::vector<Entry> entries;
+        FoldedHistory indexHistory{1, 1};
+        FoldedHistory tagHistory[2] = {{1, 1}, {1, 1}};
+    };
+    uint64_t index(uint64_t pc, unsigned t) const {
+        return (pc ^ (pc >> (tableBits - t)) ^ tables[t].indexHistory.get()) & ((1u << tableBits) - 1);
+    }
+    uint16_t tag(uint64_t pc, unsigned t) const {
+        return (pc ^ tables[t].tagHistory[0].get() ^ (tables[t].tagHistory[1].get() << 1)) & ((1u << TagBits) - 1);
+    }
+    Entry &entry(int t) { return tables[t].entries[indices[t]]; }
+
+    Bimodal base;
+    unsigned tableBits;
+    Table tables[NumTables];
+    GlobalHistory history;
+    uint64_t branches = 0;
+    // state carried from predict() to update()
+    uint64_t indices[NumTables] = {};
+    uint16_t tags[NumTables] = {};
+    int provider = -1;
+    int alternate = -1;
+    bool prediction = false;
+    bool alternatePrediction = false;
+};
+
+}
+
+std::unique_ptr<Predictor> createBimodal(unsigned tableBits) {
+    return std::make_unique<Bimodal>(tableBits);
+}
+
+std::unique_ptr<Predictor> createGshare(unsigned tableBits, unsigned historyBits) {
+    return std::make_unique<Gshare>(tableBits, historyBits);
+}
+
+std::unique_ptr<Predictor> createTage(unsigned tableBits) {
+    return std::make_unique<Tage>(tableBits);
+}
+
+}
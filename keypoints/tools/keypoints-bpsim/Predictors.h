@@ -0,0 +1,33 @@
+// Simplified models of common hardware direction predictors. They only model
+// the prediction tables, not timing, which is enough to rank branches by how
+// hard they are to predict.
+#ifndef KEYPOINTS_BPSIM_PREDICTORS_H
+#define KEYPOINTS_BPSIM_PREDICTORS_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace keypoints {
+
+class Predictor {
+    public:
+    virtual ~Predictor() = default;
+    virtual std::string name() const = 0;
+    virtual bool predict(uint64_t pc) = 0;
+    // Always called right after predict() for the same branch.
+    virtual void update(uint64_t pc, bool taken) = 0;
+};
+
+// A table of 2-bit saturating counters indexed by the branch address.
+std::unique_ptr<Predictor> createBimodal(unsigned tableBits);
+// Like bimodal, but the index is the address xor'd with the global history.
+std::unique_ptr<Predictor> createGshare(unsigned tableBits, unsigned historyBits);
+// A small TAGE: a bimodal base plus four tagged tables indexed with
+// geometrically longer global histories.
+std::unique_ptr<Predictor> createTage(unsigned tableBits);
+
+}
+
+#endif
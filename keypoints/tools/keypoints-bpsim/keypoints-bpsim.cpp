@@ -0,0 +1,243 @@
+// Replays a branch trace through simulated branch predictors and ranks source
+// branches by how often they were mispredicted, to find candidates for
+// branchless rewrites or __builtin_expect.
+//
+// Branch tags are grouped into sites, one per branch or switch, by the
+// branch_sites.txt the plugin writes along with the dictionary, or failing
+// that by their source file and condition line. A site with two tags is a
+// conditional branch whose lower tag is the condition's true successor, which
+// is treated as taken. Sites with more tags are switches and are predicted
+// with a last-target table.
+#include "Dictionary.h"
+#include "Predictors.h"
+#include "Trace.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <unordered_map>
+
+using namespace llvm;
+using namespace keypoints;
+
+enum class PredictorKind { Bimodal, Gshare, Tage };
+
+static cl::OptionCategory Category("keypoints-bpsim options");
+
+static cl::opt<std::string> TracePath(cl::Positional, cl::desc("<trace>"), cl::Required, cl::cat(Category));
+static cl::opt<std::string> DictionaryPath("dictionary", cl::desc("branch_dictionary.txt for the traced program"), cl::value_desc("path"), cl::init("branch_dictionary.txt"), cl::cat(Category));
+static cl::opt<std::string> SitesPath("sites", cl::desc("branch_sites.txt for the traced program, listing the tags of each branch"), cl::value_desc("path"), cl::init("branch_sites.txt"), cl::cat(Category));
+static cl::list<PredictorKind> Predictors("predictor", cl::desc("Predictors to simulate (default: all)"), cl::CommaSeparated,
+    cl::values(
+        clEnumValN(PredictorKind::Bimodal, "bimodal", "2-bit counters indexed by address"),
+        clEnumValN(PredictorKind::Gshare, "gshare", "2-bit counters indexed by address xor global history"),
+        clEnumValN(PredictorKind::Tage, "tage", "bimodal base with four tagged global history tables")), cl::cat(Category));
+static cl::opt<unsigned> TableBits("table-bits", cl::desc("log2 of the entries in each predictor table"), cl::init(12), cl::cat(Category));
+static cl::opt<unsigned> HistoryBits("history-bits", cl::desc("Global history length for gshare"), cl::init(12), cl::cat(Category));
+static cl::opt<unsigned> Top("top", cl::desc("Number of sites to report, 0 for all"), cl::init(20), cl::cat(Category));
+
+namespace {
+
+struct Site {
+    std::string file_name;
+    int condition_line;
+    // tags in ascending order; for two way branches the first is "taken"
+    std::vector<int> ids;
+    uint64_t pc = 0;
+    uint64_t executions = 0;
+    // per predictor for conditional sites, a single entry for switches
+    std::vector<uint64_t> mispredicts;
+    int lastTarget = -1;
+    bool conditional() const { return ids.size() == 2; }
+};
+
+// Spreads site numbers out like real branch addresses so the tables alias.
+uint64_t sitePC(const std::string &file, int line) {
+    uint64_t h = std::hash<std::string>()(file) ^ ((uint64_t)line * 0x9e3779b97f4a7c15ULL);
+    return (h ^ (h >> 29)) << 2;
+}
+
+}
+
+int main(int argc, char **argv) {
+    cl::HideUnrelatedOptions(Category);
+    cl::ParseCommandLineOptions(argc, argv, "KeyPoints branch predictor simulator\n");
+    if (TableBits < 4 || TableBits > 24) {
+        errs() << "--table-bits must be between 4 and 24\n";
+        return 1;
+    }
+
+    Dictionary D;
+    if (!D.load(DictionaryPath)) {
+        errs() << "unable to read dictionary " << DictionaryPath << "\n";
+        return 1;
+    }
+    std::vector<PredictorKind> kinds{PredictorKind::Bimodal, PredictorKind::Gshare, PredictorKind::Tage};
+    if (!Predictors.empty()) {
+        kinds.assign(Predictors.begin(), Predictors.end());
+    }
+    std::vector<std::unique_ptr<Predictor>> predictors;
+    for (auto kind : kinds) {
+        switch (kind) {
+        case PredictorKind::Bimodal: predictors.push_back(createBimodal(TableBits)); break;
+        case PredictorKind::Gshare: predictors.push_back(createGshare(TableBits, HistoryBits)); break;
+        case PredictorKind::Tage: predictors.push_back(createTage(TableBits)); break;
+        }
+    }
+
+    // group the tags into sites and index them by tag
+    std::vector<Site> sites;
+    std::vector<int> siteOf(D.entries().size(), -1);
+    std::ifstream sitesFile(SitesPath);
+    if (sitesFile) {
+        std::string line;
+        while (std::getline(sitesFile, line)) {
+            // br_N br_M ...: the tags of one branch or switch
+            std::istringstream tags(line);
+            std::string tag;
+            Site S;
+            while (tags >> tag) {
+                auto entry = tag.compare(0, 3, "br_") == 0 ? D.lookup(std::atoi(tag.c_str() + 3)) : nullptr;
+                if (!entry || siteOf[entry->id] >= 0) {
+                    continue;
+                }
+                if (S.ids.empty()) {
+                    S.file_name = entry->file_name;
+                    S.condition_line = entry->condition_line;
+                }
+                S.ids.push_back(entry->id);
+                siteOf[entry->id] = sites.size();
+            }
+            if (!S.ids.empty()) {
+                // the site number keeps branches on one line apart
+                S.pc = sitePC(S.file_name, S.condition_line) ^ (sites.size() << 2);
+                sites.push_back(S);
+            }
+        }
+    } else {
+        errs() << "warning: unable to read " << SitesPath << ", grouping tags by source line, so branches sharing a line are simulated as one switch\n";
+        std::map<std::pair<std::string, int>, size_t> siteIndex;
+        for (auto &E : D.entries()) {
+            if (!E.valid()) {
+                continue;
+            }
+            auto key = std::make_pair(E.file_name, E.condition_line);
+            auto it = siteIndex.find(key);
+            if (it == siteIndex.end()) {
+                it = siteIndex.emplace(key, sites.size()).first;
+                Site S;
+                S.file_name = E.file_name;
+                S.condition_line = E.condition_line;
+                S.pc = sitePC(E.file_name, E.condition_line);
+                sites.push_back(S);
+            }
+            sites[it->second].ids.push_back(E.id);
+            siteOf[E.id] = it->second;
+        }
+    }
+    for (auto &S : sites) {
+        std::sort(S.ids.begin(), S.ids.end());
+        S.mispredicts.assign(S.conditional() ? predictors.size() : 1, 0);
+    }
+
+    TraceReader R;
+    if (!R.open(TracePath)) {
+        errs() << "unable to open " << TracePath << "\n";
+        return 1;
+    }
+    TraceEvent E;
+    uint64_t unknown = 0, skipped = 0;
+    std::vector<uint64_t> totalMispredicts(predictors.size(), 0);
+    uint64_t conditionalExecutions = 0;
+    while (R.next(E)) {
+        if (E.kind != TraceEvent::Branch) {
+            continue;
+        }
+        if (E.id >= (int64_t)siteOf.size() || siteOf[E.id] < 0) {
+            unknown++;
+            continue;
+        }
+        auto &S = sites[siteOf[E.id]];
+        if (S.ids.size() < 2) {
+            // the other successor was tagged under a different site, so this
+            // event alone doesn't say which way the branch went
+            skipped++;
+            continue;
+        }
+        S.executions++;
+        if (!S.conditional()) {
+            S.mispredicts[0] += S.lastTarget != E.id;
+            S.lastTarget = E.id;
+            continue;
+        }
+        conditionalExecutions++;
+        bool taken = E.id == S.ids[0];
+        for (size_t p = 0; p < predictors.size(); p++) {
+            if (predictors[p]->predict(S.pc) != taken) {
+                S.mispredicts[p]++;
+                totalMispredicts[p]++;
+            }
+            predictors[p]->update(S.pc, taken);
+        }
+    }
+    if (unknown > 0) {
+        errs() << "warning: " << unknown << " events had tags missing from " << DictionaryPath << "\n";
+    }
+    size_t singleSites = 0, switchSites = 0;
+    for (auto &S : sites) {
+        singleSites += S.ids.size() < 2;
+        switchSites += S.ids.size() > 2;
+    }
+    if (singleSites > 0) {
+        errs() << "note: " << singleSites << " sites have a single tag, since their other successor is tagged by another branch; their "
+               << skipped << " events were not simulated\n";
+    }
+    if (switchSites > 0 && !sitesFile) {
+        errs() << "note: " << switchSites << " lines with more than two tags were simulated as switches; some may be several branches\n";
+    }
+
+    outs() << format("%-10s %14s %14s %8s\n", (const char *)"predictor", (const char *)"branches", (const char *)"mispredicts", (const char *)"rate");
+    for (size_t p = 0; p < predictors.size(); p++) {
+        outs() << format("%-10s %14llu %14llu %7.2f%%\n", predictors[p]->name().c_str(),
+            (unsigned long long)conditionalExecutions, (unsigned long long)totalMispredicts[p],
+            conditionalExecutions ? 100.0 * totalMispredicts[p] / conditionalExecutions : 0.0);
+    }
+
+    // rank by the first requested predictor, showing the others alongside
+    std::vector<Site *> ranked;
+    for (auto &S : sites) {
+        if (S.executions > 0) {
+            ranked.push_back(&S);
+        }
+    }
+    std::sort(ranked.begin(), ranked.end(), [](Site *a, Site *b) {
+        if (a->mispredicts[0] != b->mispredicts[0]) {
+            return a->mispredicts[0] > b->mispredicts[0];
+        }
+        return a->executions > b->executions;
+    });
+    size_t shown = Top == 0 ? ranked.size() : std::min<size_t>(Top, ranked.size());
+    outs() << "\nsites by " << predictors[0]->name() << " mispredictions:\n";
+    for (size_t i = 0; i < shown; i++) {
+        auto &S = *ranked[i];
+        std::string loc = S.file_name + ":" + std::to_string(S.condition_line);
+        outs() << format("  %-40s %12llu executions", loc.c_str(), (unsigned long long)S.executions);
+        if (!S.conditional()) {
+            outs() << format("  switch: %llu target mispredicts", (unsigned long long)S.mispredicts[0]);
+        } else {
+            for (size_t p = 0; p < predictors.size(); p++) {
+                outs() << format("  %s %llu (%.1f%%)", predictors[p]->name().c_str(), (unsigned long long)S.mispredicts[p],
+                    100.0 * S.mispredicts[p] / S.executions);
+            }
+        }
+        outs() << "  [";
+        for (size_t j = 0; j < S.ids.size(); j++) {
+            outs() << (j ? " " : "") << "br_" << S.ids[j];
+        }
+        outs() << "]\n";
+    }
+    return 0;
+}
@@ -0,0 +1,355 @@
+// Builds an instrumented program, compiling every translation unit with the
+// KeyPoints plugin in parallel and then linking them.
+//
+//   keypoints-build --plugin=KeyPointsPass.so --runtime=branchlog.c [-j N]
+//       [--cc=clang-15] [--keep-temps] [--mode=trace] [--cache-dir=dir]
+//       [--prune-counters=dump --prune-dictionary=dictionary]
+//       [compiler flags and sources...] [-o out]
+//
+// Every argument that isn't one of the options above or a source file is
+// passed through to the compiler, and to the linker unless -c is given.
+// Plugin options (-mllvm -keypoints-*) only go to the instrumented compiles,
+// since clang rejects them anywhere the plugin isn't loaded.
+// Compiles run in the current directory so relative paths in flags work, but
+// each writes its object, dictionary and branch sites into its own directory
+// so they don't collide; IDs come from one shared counter file, which the
+// plugin locks, and the dictionaries and sites are merged in ID order once
+// every compile is done. Module names are recorded relative to the current
+// directory, without the ../ that instrument.sh adds.
+//
+// Options are parsed by hand rather than with cl:: since arbitrary compiler
+// flags have to pass through untouched.
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <string>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using namespace llvm;
+
+namespace {
+
+struct Options {
+    std::string plugin;
+    std::string runtime;
+    std::string cc = "clang-15";
+    std::string output;
+    std::string pruneCounters;
+    std::string pruneDictionary;
+    std::string cacheDir;
+    std::vector<std::string> pluginArgs;
+    unsigned jobs = 0;
+    bool keepTemps = false;
+    bool compileOnly = false;
+    std::vector<std::string> sources;
+    std::vector<std::string> flags;
+};
+
+struct Job {
+    std::string source;
+    std::string directory;
+    std::string object;
+    bool instrument;
+};
+
+void usage() {
+    errs() << "usage: keypoints-build --plugin=KeyPointsPass.so [--runtime=branchlog.c] [-j N] [--cc=clang-15]\n"
+              "                       [--keep-temps] [--mode=trace] [--cache-dir=dir]\n"
+              "                       [--prune-counters=dump --prune-dictionary=dictionary]\n"
+              "                       [compiler flags and sources...] [-o output]\n";
+}
+
+bool isSource(StringRef arg) {
+    if (arg.startswith("-")) {
+        return false;
+    }
+    auto ext = sys::path::extension(arg);
+    return ext == ".c" || ext == ".cc" || ext == ".cpp" || ext == ".cxx" || ext == ".c++" || ext == ".C";
+}
+
+bool parseArgs(int argc, char **argv, Options &O) {
+    for (int i = 1; i < argc; i++) {
+        StringRef arg(argv[i]);
+        if (arg.consume_front("--plugin=")) {
+            O.plugin = arg.str();
+        } else if (arg.consume_front("--runtime=")) {
+            O.runtime = arg.str();
+        } else if (arg.consume_front("--cc=")) {
+            O.cc = arg.str();
+        } else if (arg.consume_front("--mode=")) {
+            O.pluginArgs.push_back("-keypoints-mode=" + arg.str());
+        } else if (arg == "-mllvm" && i + 1 < argc && StringRef(argv[i + 1]).startswith("-keypoints-")) {
+            StringRef option(argv[++i]);
+            // where each compile writes is up to the driver, which merges the files
+            for (auto owned : {"-keypoints-counter-file", "-keypoints-dictionary-file", "-keypoints-sites-file", "-keypoints-strip-prefix"}) {
+                if (option.startswith(owned)) {
+                    errs() << owned << " is set by keypoints-build\n";
+                    return false;
+                }
+            }
+            O.pluginArgs.push_back(option.str());
+        } else if (arg.consume_front("--cache-dir=")) {
+            O.cacheDir = arg.str();
+        } else if (arg.consume_front("--prune-counters=")) {
+            O.pruneCounters = arg.str();
+        } else if (arg.consume_front("--prune-dictionary=")) {
+            O.pruneDictionary = arg.str();
+        } else if (arg == "--keep-temps") {
+            O.keepTemps = true;
+        } else if (arg == "-j" || arg.startswith("--jobs=") || (arg.startswith("-j") && arg.size() > 2)) {
+            StringRef value;
+            if (arg == "-j") {
+                if (++i == argc) {
+                    return false;
+                }
+                value = argv[i];
+            } else {
+                value = arg.startswith("--jobs=") ? arg.drop_front(7) : arg.drop_front(2);
+            }
+            if (value.getAsInteger(10, O.jobs)) {
+                return false;
+            }
+        } else if (arg == "-o") {
+            if (++i == argc) {
+                return false;
+            }
+            O.output = argv[i];
+        } else if (arg == "--help" || arg == "-h") {
+            return false;
+        } else if (isSource(arg)) {
+            O.sources.push_back(arg.str());
+        } else {
+            O.compileOnly |= arg == "-c";
+            O.flags.push_back(arg.str());
+        }
+    }
+    if (O.compileOnly && !O.output.empty()) {
+        // like cc -c -o with several sources: every source gets its own object
+        errs() << "-o can't be used with -c\n";
+        return false;
+    }
+    return !O.plugin.empty() && !O.sources.empty() && O.pruneCounters.empty() == O.pruneDictionary.empty();
+}
+
+std::string absolute(const std::string &path) {
+    SmallString<256> abs(path);
+    sys::fs::make_absolute(abs);
+    return std::string(abs);
+}
+
+// Forks and runs `args`, returning the child's pid.
+pid_t spawn(const std::vector<std::string> &args) {
+    std::vector<char *> argv;
+    for (auto &a : args) {
+        argv.push_back(const_cast<char *>(a.c_str()));
+    }
+    argv.push_back(nullptr);
+    pid_t pid = fork();
+    if (pid == 0) {
+        execvp(argv[0], argv.data());
+        _exit(127);
+    }
+    return pid;
+}
+
+bool wait(pid_t pid) {
+    int status;
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) {
+            return false;
+        }
+    }
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+// Runs every job with at most `jobs` at a time. Stops starting new ones after
+// the first failure but lets the running ones finish.
+bool runAll(const std::vector<Job> &jobs, unsigned parallel, const Options &O, const std::string &counterFile) {
+    std::map<pid_t, const Job *> running;
+    size_t next = 0;
+    bool ok = true;
+    auto plugin = absolute(O.plugin);
+    auto cwd = absolute(".") + "/";
+    // without debug info wanted, compile with just line tables for the plugin
+    // and have it drop them, so the objects come out as with -g0
+    auto lastDebugFlag = std::find_if(O.flags.rbegin(), O.flags.rend(), [](const std::string &f) { return StringRef(f).startswith("-g"); });
+    bool lineTablesOnly = lastDebugFlag == O.flags.rend() || *lastDebugFlag == "-g0";
+    while (next < jobs.size() || !running.empty()) {
+        while (ok && next < jobs.size() && running.size() < parallel) {
+            auto &J = jobs[next++];
+            std::vector<std::string> args{O.cc, "-c"};
+            if (J.instrument) {
+                // -load registers the plugin's options before -mllvm is parsed
+                args.insert(args.end(), {"-Xclang", "-load", "-Xclang", plugin, "-fpass-plugin=" + plugin});
+                for (auto &a : O.pluginArgs) {
+                    args.insert(args.end(), {"-mllvm", a});
+                }
+                args.insert(args.end(), {"-mllvm", "-keypoints-counter-file=" + counterFile,
+                    "-mllvm", "-keypoints-dictionary-file=" + J.directory + "/branch_dictionary.txt",
+                    "-mllvm", "-keypoints-sites-file=" + J.directory + "/branch_sites.txt",
+                    "-mllvm", "-keypoints-strip-prefix=" + cwd});
+                if (lineTablesOnly) {
+                    args.insert(args.end(), {"-mllvm", "-keypoints-strip-debug"});
+                }
+                if (!O.cacheDir.empty()) {
+                    args.insert(args.end(), {"-mllvm", "-keypoints-cache-dir=" + absolute(O.cacheDir)});
+                }
+                if (!O.pruneCounters.empty()) {
+                    args.insert(args.end(), {"-mllvm", "-keypoints-prune-counters=" + absolute(O.pruneCounters),
+                        "-mllvm", "-keypoints-prune-dictionary=" + absolute(O.pruneDictionary)});
+                }
+            }
+            for (auto &f : O.flags) {
+                if (f != "-c") {
+                    args.push_back(f);
+                }
+            }
+            if (J.instrument && lineTablesOnly) {
+                // the plugin needs line information; after the user's flags so it overrides -g0
+                args.push_back("-gline-tables-only");
+            }
+            args.insert(args.end(), {absolute(J.source), "-o", J.object});
+            auto pid = spawn(args);
+            if (pid < 0) {
+                errs() << "unable to start " << O.cc << "\n";
+                ok = false;
+                break;
+            }
+            running[pid] = &J;
+        }
+        if (running.empty()) {
+            break;
+        }
+        int status;
+        pid_t pid = waitpid(-1, &status, 0);
+        if (pid < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        auto it = running.find(pid);
+        if (it == running.end()) {
+            continue;
+        }
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            errs() << "compiling " << it->second->source << " failed\n";
+            ok = false;
+        }
+        running.erase(it);
+    }
+    return ok;
+}
+
+// Concatenates the per-job dictionaries, or lists of branch sites, in ID order.
+bool mergeDictionaries(const std::vector<Job> &jobs, const std::string &path) {
+    std::vector<std::pair<long, std::string>> entries;
+    for (auto &J : jobs) {
+        std::ifstream in(J.directory + "/" + path);
+        std::string line;
+        while (std::getline(in, line)) {
+            if (line.compare(0, 3, "br_") == 0) {
+                entries.emplace_back(std::strtol(line.c_str() + 3, nullptr, 10), line);
+            }
+        }
+    }
+    std::sort(entries.begin(), entries.end());
+    std::ofstream out(path, std::ios_base::trunc);
+    for (auto &[id, line] : entries) {
+        out << line << "\n";
+    }
+    out.close();
+    return !out.fail();
+}
+
+}
+
+int main(int argc, char **argv) {
+    Options O;
+    if (!parseArgs(argc, argv, O)) {
+        usage();
+        return 1;
+    }
+    unsigned parallel = O.jobs ? O.jobs : std::max(1u, std::thread::hardware_concurrency());
+
+    auto tmpdir = absolute("keypoints-build." + std::to_string(getpid()));
+    std::vector<Job> jobs;
+    auto addJob = [&](const std::string &source, bool instrument) {
+        auto dir = tmpdir + "/" + std::to_string(jobs.size());
+        if (auto ec = sys::fs::create_directories(dir)) {
+            errs() << "unable to create " << dir << ": " << ec.message() << "\n";
+            return false;
+        }
+        auto stem = sys::path::stem(source).str();
+        jobs.push_back({source, dir, dir + "/" + stem + ".o", instrument});
+        return true;
+    };
+    for (auto &s : O.sources) {
+        if (!addJob(s, true)) {
+            return 1;
+        }
+    }
+    if (!O.runtime.empty() && !addJob(O.runtime, false)) {
+        return 1;
+    }
+    if (O.compileOnly) {
+        // the objects are all left in the current directory, so a/util.c and
+        // b/util.c would overwrite each other
+        std::map<std::string, const Job *> objects;
+        for (auto &J : jobs) {
+            auto object = sys::path::filename(J.object).str();
+            auto [it, added] = objects.insert({object, &J});
+            if (!added) {
+                errs() << it->second->source << " and " << J.source << " would both be compiled to " << object << "\n";
+                sys::fs::remove_directories(tmpdir);
+                return 1;
+            }
+        }
+    }
+
+    if (!runAll(jobs, parallel, O, tmpdir + "/counter.log") ||
+        !mergeDictionaries(jobs, "branch_dictionary.txt") || !mergeDictionaries(jobs, "branch_sites.txt")) {
+        errs() << "build failed, intermediate files are in " << tmpdir << "\n";
+        return 1;
+    }
+
+    bool ok = true;
+    if (O.compileOnly) {
+        // like cc -c, leave an object per source in the current directory
+        for (auto &J : jobs) {
+            auto object = sys::path::filename(J.object).str();
+            if (auto ec = sys::fs::copy_file(J.object, object)) {
+                errs() << "unable to write " << object << ": " << ec.message() << "\n";
+                ok = false;
+            }
+        }
+    } else {
+        std::vector<std::string> args{O.cc};
+        for (auto &J : jobs) {
+            args.push_back(J.object);
+        }
+        args.insert(args.end(), O.flags.begin(), O.flags.end());
+        args.insert(args.end(), {"-o", O.output.empty() ? "a.out" : O.output});
+        auto pid = spawn(args);
+        ok = pid > 0 && wait(pid);
+        if (!ok) {
+            errs() << "linking failed\n";
+        }
+    }
+    if (!ok) {
+        errs() << "intermediate files are in " << tmpdir << "\n";
+        return 1;
+    }
+    if (!O.keepTemps) {
+        sys::fs::remove_directories(tmpdir);
+    }
+    return 0;
+}
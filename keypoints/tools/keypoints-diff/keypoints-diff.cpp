@@ -0,0 +1,193 @@
+// Compares two branch traces, e.g. from a good and a bad run, and reports the
+// first point where control flow diverges along with per-tag count deltas.
+//
+// Both traces are streamed in lockstep so memory use is bounded by the number
+// of distinct tags, not the trace length, and traces larger than RAM work.
+#include "Dictionary.h"
+#include "Trace.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+#include <deque>
+#include <unordered_map>
+#include <vector>
+
+using namespace llvm;
+using namespace keypoints;
+
+static cl::OptionCategory Category("keypoints-diff options");
+
+static cl::opt<std::string> GoodTrace(cl::Positional, cl::desc("<good trace>"), cl::Required, cl::cat(Category));
+static cl::opt<std::string> BadTrace(cl::Positional, cl::desc("<bad trace>"), cl::Required, cl::cat(Category));
+static cl::opt<std::string> DictionaryPath("dictionary", cl::desc("branch_dictionary.txt used to annotate tags with source lines"), cl::value_desc("path"), cl::cat(Category));
+static cl::opt<unsigned> Context("context", cl::desc("Number of events to show around the first divergence"), cl::init(5), cl::cat(Category));
+static cl::opt<unsigned> Top("top", cl::desc("Number of count deltas to report, 0 for all"), cl::init(20), cl::cat(Category));
+
+namespace {
+
+struct Counts {
+    uint64_t good = 0;
+    uint64_t bad = 0;
+};
+
+class TagCounts {
+    public:
+    Counts &get(const TraceEvent &E) {
+        if (E.kind == TraceEvent::Branch && E.id < (1 << 24)) {
+            // branch IDs are dense so index directly instead of hashing the text
+            if ((size_t)E.id >= branches.size()) {
+                branches.resize(E.id + 1);
+            }
+            return branches[E.id];
+        }
+        return other[E.text];
+    }
+    std::vector<std::pair<std::string, Counts>> collect() const {
+        std::vector<std::pair<std::string, Counts>> all;
+        for (size_t i = 0; i < branches.size(); i++) {
+            if (branches[i].good != branches[i].bad) {
+                all.emplace_back("br_" + std::to_string(i), branches[i]);
+            }
+        }
+        for (auto &[tag, C] : other) {
+            if (C.good != C.bad) {
+                all.emplace_back(tag, C);
+            }
+        }
+        return all;
+    }
+
+    private:
+    std::vector<Counts> branches;
+    std::unordered_map<std::string, Counts> other;
+};
+
+std::string annotate(const Dictionary &D, const TraceEvent &E) {
+    if (E.kind != TraceEvent::Branch) {
+        return E.text;
+    }
+    auto loc = D.location(E.id);
+    return loc.empty() ? E.text : E.text + " (" + loc + ")";
+}
+
+// Drains the rest of a trace into the counts once the other one has ended.
+void drain(TraceReader &R, TraceEvent &E, TagCounts &counts, bool good) {
+    while (R.next(E)) {
+        auto &C = counts.get(E);
+        good ? C.good++ : C.bad++;
+    }
+}
+
+}
+
+int main(int argc, char **argv) {
+    cl::HideUnrelatedOptions(Category);
+    cl::ParseCommandLineOptions(argc, argv, "KeyPoints trace differ\n");
+
+    Dictionary D;
+    if (!DictionaryPath.empty() && !D.load(DictionaryPath)) {
+        errs() << "unable to read dictionary " << DictionaryPath << "\n";
+        return 1;
+    }
+    TraceReader G, B;
+    if (!G.open(GoodTrace)) {
+        errs() << "unable to open " << GoodTrace << "\n";
+        return 1;
+    }
+    if (!B.open(BadTrace)) {
+        errs() << "unable to open " << BadTrace << "\n";
+        return 1;
+    }
+
+    TagCounts counts;
+    std::deque<TraceEvent> history;
+    TraceEvent GE, BE;
+    bool diverged = false;
+    while (true) {
+        bool hasGood = G.next(GE);
+        bool hasBad = B.next(BE);
+        if (!hasGood && !hasBad) {
+            break;
+        }
+        if (hasGood) {
+            counts.get(GE).good++;
+        }
+        if (hasBad) {
+            counts.get(BE).bad++;
+        }
+        if (hasGood && hasBad && GE.text == BE.text) {
+            if (Context > 0) {
+                if (history.size() == Context) {
+                    history.pop_front();
+                }
+                history.push_back(GE);
+            }
+            continue;
+        }
+
+        diverged = true;
+        outs() << "traces diverge at event " << std::max(G.position(), B.position()) - 1;
+        if (!hasGood || !hasBad) {
+            outs() << " (" << (hasGood ? BadTrace : GoodTrace) << " ends)";
+        }
+        outs() << "\n";
+        for (auto &E : history) {
+            outs() << "    " << annotate(D, E) << "\n";
+        }
+        // print context from both sides, then keep counting the remainder
+        std::vector<std::string> goodAfter, badAfter;
+        for (unsigned i = 0; i < std::max<unsigned>(Context, 1); i++) {
+            if (i > 0 && hasGood && (hasGood = G.next(GE))) {
+                counts.get(GE).good++;
+            }
+            if (i > 0 && hasBad && (hasBad = B.next(BE))) {
+                counts.get(BE).bad++;
+            }
+            if (hasGood) {
+                goodAfter.push_back(annotate(D, GE));
+            }
+            if (hasBad) {
+                badAfter.push_back(annotate(D, BE));
+            }
+        }
+        for (auto &line : goodAfter) {
+            outs() << "  - " << line << "\n";
+        }
+        for (auto &line : badAfter) {
+            outs() << "  + " << line << "\n";
+        }
+        drain(G, GE, counts, true);
+        drain(B, BE, counts, false);
+        break;
+    }
+
+    if (!diverged) {
+        outs() << "traces are identical (" << G.position() << " events)\n";
+        return 0;
+    }
+
+    auto deltas = counts.collect();
+    auto magnitude = [](const Counts &C) {
+        return C.good > C.bad ? C.good - C.bad : C.bad - C.good;
+    };
+    std::sort(deltas.begin(), deltas.end(), [&](auto &a, auto &b) {
+        auto ma = magnitude(a.second), mb = magnitude(b.second);
+        return ma != mb ? ma > mb : a.first < b.first;
+    });
+    outs() << "\n" << deltas.size() << " tags with differing counts (" << GoodTrace << " -> " << BadTrace << ")\n";
+    outs() << format("  %-24s %12s %12s %13s\n", (const char *)"tag", (const char *)"good", (const char *)"bad", (const char *)"delta");
+    size_t shown = Top == 0 ? deltas.size() : std::min<size_t>(Top, deltas.size());
+    for (size_t i = 0; i < shown; i++) {
+        auto &[tag, C] = deltas[i];
+        int64_t delta = (int64_t)C.bad - (int64_t)C.good;
+        outs() << format("  %-24s %12llu %12llu %+13lld", tag.c_str(), (unsigned long long)C.good, (unsigned long long)C.bad, (long long)delta);
+        TraceEvent E;
+        parseTraceLine(tag, E);
+        if (E.kind == TraceEvent::Branch && D.lookup(E.id)) {
+            outs() << "  " << D.location(E.id);
+        }
+        outs() << "\n";
+    }
+    return 1;
+}
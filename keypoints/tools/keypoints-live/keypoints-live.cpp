@@ -0,0 +1,180 @@
+// Watches programs running with KEYPOINTS_SHM as they execute and reports the
+// branches and source lines that are hot right now.
+#include "Dictionary.h"
+#include "Ring.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <map>
+#include <sys/mman.h>
+#include <thread>
+#include <unistd.h>
+
+using namespace llvm;
+using namespace keypoints;
+
+static cl::OptionCategory Category("keypoints-live options");
+
+static cl::opt<std::string> ShmName(cl::Positional, cl::desc("<shared memory name, e.g. /myservice>"), cl::Required, cl::cat(Category));
+static cl::opt<std::string> DictionaryPath("dictionary", cl::desc("Branch dictionary used to name source lines"), cl::value_desc("path"), cl::init("branch_dictionary.txt"), cl::cat(Category));
+static cl::opt<unsigned> IntervalMs("interval", cl::desc("Milliseconds between reports"), cl::init(1000), cl::cat(Category));
+static cl::opt<unsigned> Top("top", cl::desc("Number of branches and lines to show"), cl::init(10), cl::cat(Category));
+static cl::opt<unsigned> Reports("reports", cl::desc("Stop after N reports, 0 to run until killed"), cl::init(0), cl::cat(Category));
+static cl::opt<double> Decay("decay", cl::desc("Weight of the previous rate when smoothing, between 0 and 1"), cl::init(0.5), cl::cat(Category));
+static cl::opt<bool> Unlink("unlink", cl::desc("Remove the shared memory name on startup so the next writer creates a fresh ring"), cl::cat(Category));
+
+// Maps the ring, waiting for the first writer to create it.
+static const RingHeader *attach(const std::string &name) {
+    bool waiting = false;
+    while (true) {
+        int fd = shm_open(name.c_str(), O_RDONLY, 0);
+        if (fd >= 0) {
+            RingHeader probe;
+            if (pread(fd, &probe, sizeof(probe), 0) == sizeof(probe) && memcmp(probe.magic, RingMagic, sizeof(RingMagic)) == 0) {
+                size_t size = sizeof(RingHeader) + probe.capacity * sizeof(RingSlot);
+                void *mapping = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+                close(fd);
+                if (mapping == MAP_FAILED) {
+                    errs() << name << ": " << strerror(errno) << "\n";
+                    return nullptr;
+                }
+                return static_cast<const RingHeader *>(mapping);
+            }
+            close(fd);
+        } else if (errno != ENOENT) {
+            errs() << name << ": " << strerror(errno) << "\n";
+            return nullptr;
+        }
+        if (!waiting) {
+            errs() << "waiting for a program to start with KEYPOINTS_SHM=" << name << "\n";
+            waiting = true;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+}
+
+template <typename T>
+static std::vector<std::pair<T, double>> hottest(const std::map<T, double> &rates) {
+    std::vector<std::pair<T, double>> sorted(rates.begin(), rates.end());
+    auto count = std::min<size_t>(Top, sorted.size());
+    std::partial_sort(sorted.begin(), sorted.begin() + count, sorted.end(),
+                      [](const auto &a, const auto &b) { return a.second > b.second; });
+    sorted.resize(count);
+    return sorted;
+}
+
+int main(int argc, char **argv) {
+    cl::HideUnrelatedOptions(Category);
+    cl::ParseCommandLineOptions(argc, argv, "KeyPoints live trace analyzer\n");
+
+    Dictionary dictionary;
+    if (!dictionary.load(DictionaryPath)) {
+        errs() << "warning: couldn't read " << DictionaryPath << ", showing branch IDs only\n";
+    }
+    if (Unlink) {
+        shm_unlink(ShmName.c_str());
+    }
+    auto header = attach(ShmName);
+    if (!header) {
+        return 1;
+    }
+    auto capacity = header->capacity;
+    auto slots = reinterpret_cast<const RingSlot *>(header + 1);
+
+    // start with whatever is already in the ring
+    auto head = __atomic_load_n(&header->head, __ATOMIC_ACQUIRE);
+    uint64_t cursor = head > capacity ? head - capacity : 0;
+    // slot the previous report stopped at because its write wasn't finished
+    uint64_t stalled = UINT64_MAX;
+    std::map<int, double> branchRates;
+    std::map<std::string, double> lineRates;
+    auto last = std::chrono::steady_clock::now();
+    for (unsigned report = 1; Reports == 0 || report <= Reports; report++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(IntervalMs));
+        auto now = std::chrono::steady_clock::now();
+        double seconds = std::chrono::duration<double>(now - last).count();
+        last = now;
+
+        DenseMap<uint64_t, uint64_t> counts;
+        uint64_t read = 0, fp = 0, lost = 0;
+        auto previous = head;
+        head = __atomic_load_n(&header->head, __ATOMIC_ACQUIRE);
+        if (head - cursor > capacity) {
+            // the writers lapped us
+            lost += head - capacity - cursor;
+            cursor = head - capacity;
+        }
+        for (; cursor < head; cursor++) {
+            uint64_t event;
+            if (readRingSlot(slots, capacity, cursor, event)) {
+                read++;
+                if (event & RingFunctionPointer) {
+                    fp++;
+                } else {
+                    counts[event]++;
+                }
+                continue;
+            }
+            // a writer has claimed the slot but not finished it, pick it up
+            // next time; if it's still unfinished a whole interval later, the
+            // writer died mid-write and the slot would block every report
+            // until the ring wraps around
+            if (ringSlotPending(slots, capacity, cursor) && cursor != stalled) {
+                stalled = cursor;
+                break;
+            }
+            lost++;
+        }
+
+        // when events were overwritten, what was read is a sample of the
+        // newest ones, so scale it up to what was actually logged
+        double scale = lost > 0 && read > 0 ? double(read + lost) / read : 1;
+
+        // exponentially smoothed events per second
+        for (auto &rate : branchRates) {
+            rate.second *= Decay;
+        }
+        for (auto &rate : lineRates) {
+            rate.second *= Decay;
+        }
+        uint64_t total = 0;
+        for (auto &count : counts) {
+            double rate = (1 - Decay) * count.second * scale / seconds;
+            int id = static_cast<int>(count.first);
+            branchRates[id] += rate;
+            auto location = dictionary.location(id);
+            if (!location.empty()) {
+                lineRates[location] += rate;
+            }
+            total += count.second;
+        }
+
+        outs() << "--- report " << report << ": " << format("%.0f", total * scale / seconds) << " branches/s, "
+               << format("%.0f", fp * scale / seconds) << " indirect calls/s";
+        if (lost > 0) {
+            outs() << format(", sampled %.2f%%", 100.0 / scale) << " of " << (head - previous) << " events";
+        }
+        outs() << "\n";
+        for (auto &branch : hottest(branchRates)) {
+            outs() << format("%12.1f/s  br_%d", branch.second, branch.first);
+            auto location = dictionary.location(branch.first);
+            if (!location.empty()) {
+                outs() << "  " << location;
+            }
+            outs() << "\n";
+        }
+        if (!lineRates.empty()) {
+            outs() << "hot lines:\n";
+            for (auto &line : hottest(lineRates)) {
+                outs() << format("%12.1f/s  ", line.second) << line.first << "\n";
+            }
+        }
+        outs().flush();
+    }
+    return 0;
+}
@@ -0,0 +1,150 @@
+// Sums the counter dumps of many runs of a program instrumented with
+// -keypoints-mode=counter into one dump and summarizes branch coverage.
+//
+// Dumps are memory mapped and split across a thread pool. Each worker sums its
+// share into a private array, which the compiler turns into vector adds, and
+// the per-worker arrays are added together at the end.
+#include "Counters.h"
+#include "Dictionary.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/Threading.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+#include <map>
+#include <mutex>
+
+using namespace llvm;
+using namespace keypoints;
+
+static cl::OptionCategory Category("keypoints-merge options");
+
+static cl::list<std::string> Inputs(cl::Positional, cl::desc("<counter dumps>"), cl::OneOrMore, cl::cat(Category));
+static cl::opt<std::string> Output("o", cl::desc("Merged dump to write"), cl::value_desc("path"), cl::init("branch_counters.merged.bin"), cl::cat(Category));
+static cl::opt<std::string> DictionaryPath("dictionary", cl::desc("branch_dictionary.txt to validate against and summarize coverage with"), cl::value_desc("path"), cl::cat(Category));
+static cl::opt<unsigned> Jobs("j", cl::desc("Number of threads, 0 to use every core"), cl::init(0), cl::cat(Category));
+static cl::opt<bool> ShowUncovered("show-uncovered", cl::desc("List every branch that was never executed"), cl::cat(Category));
+
+namespace {
+
+struct Shard {
+    std::vector<uint64_t> counters;
+    uint64_t runs = 0;
+};
+
+void addCounters(uint64_t *__restrict dst, const uint64_t *__restrict src, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        dst[i] += src[i];
+    }
+}
+
+}
+
+int main(int argc, char **argv) {
+    cl::HideUnrelatedOptions(Category);
+    cl::ParseCommandLineOptions(argc, argv, "KeyPoints counter dump merger\n\n"
+        "Pass @file to read a long list of dumps from a file.\n");
+
+    Dictionary D;
+    if (!DictionaryPath.empty() && !D.load(DictionaryPath)) {
+        errs() << "unable to read dictionary " << DictionaryPath << "\n";
+        return 1;
+    }
+
+    // every dump must come from the same dictionary, either the one given or
+    // whatever the first dump says
+    std::string error;
+    CounterDump first;
+    if (!first.open(Inputs[0], error)) {
+        errs() << Inputs[0] << ": " << error << "\n";
+        return 1;
+    }
+    uint64_t expectedHash = first.header().dictionary_hash;
+    uint64_t numCounters = first.header().num_counters;
+    if (!DictionaryPath.empty() && D.hash() != expectedHash) {
+        errs() << Inputs[0] << ": dump was not produced from " << DictionaryPath << "\n";
+        return 1;
+    }
+
+    auto strategy = Jobs == 0 ? hardware_concurrency() : hardware_concurrency(Jobs);
+    unsigned workers = std::min<size_t>(strategy.compute_thread_count(), Inputs.size());
+    std::vector<Shard> shards(workers);
+    std::mutex errorLock;
+    std::vector<std::string> errors;
+    {
+        ThreadPool pool(strategy);
+        for (unsigned w = 0; w < workers; w++) {
+            pool.async([&, w] {
+                auto &shard = shards[w];
+                shard.counters.assign(numCounters, 0);
+                for (size_t i = w; i < Inputs.size(); i += workers) {
+                    CounterDump dump;
+                    std::string error;
+                    if (dump.open(Inputs[i], error) &&
+                        (dump.header().dictionary_hash != expectedHash || dump.header().num_counters != numCounters)) {
+                        error = "dump was produced from a different dictionary";
+                    }
+                    if (!error.empty()) {
+                        std::lock_guard<std::mutex> guard(errorLock);
+                        errors.push_back(Inputs[i] + ": " + error);
+                        continue;
+                    }
+                    addCounters(shard.counters.data(), dump.counters(), numCounters);
+                    shard.runs += dump.header().runs;
+                }
+            });
+        }
+        pool.wait();
+    }
+    if (!errors.empty()) {
+        std::sort(errors.begin(), errors.end());
+        for (auto &e : errors) {
+            errs() << e << "\n";
+        }
+        return 1;
+    }
+
+    auto &merged = shards[0];
+    for (unsigned w = 1; w < workers; w++) {
+        addCounters(merged.counters.data(), shards[w].counters.data(), numCounters);
+        merged.runs += shards[w].runs;
+    }
+    if (!writeCounterDump(Output, expectedHash, merged.runs, merged.counters)) {
+        errs() << "unable to write " << Output << "\n";
+        return 1;
+    }
+    outs() << "merged " << Inputs.size() << " dumps (" << merged.runs << " runs) into " << Output << "\n";
+
+    if (DictionaryPath.empty()) {
+        return 0;
+    }
+    // per file coverage, ordered by file name for stable output
+    std::map<std::string, std::pair<size_t, size_t>> files;
+    size_t covered = 0;
+    for (auto &E : D.entries()) {
+        if (!E.valid()) {
+            continue;
+        }
+        auto &[fileCovered, fileTotal] = files[E.file_name];
+        fileTotal++;
+        if ((uint64_t)E.id < numCounters && merged.counters[E.id] > 0) {
+            fileCovered++;
+            covered++;
+        }
+    }
+    auto percent = [](size_t n, size_t total) { return total == 0 ? 100.0 : 100.0 * n / total; };
+    outs() << format("coverage: %zu/%zu branches (%.1f%%)\n", covered, D.size(), percent(covered, D.size()));
+    for (auto &[file, C] : files) {
+        outs() << format("  %-40s %6zu/%-6zu (%.1f%%)\n", file.c_str(), C.first, C.second, percent(C.first, C.second));
+    }
+    if (ShowUncovered) {
+        outs() << "uncovered:\n";
+        for (auto &E : D.entries()) {
+            if (E.valid() && ((uint64_t)E.id >= numCounters || merged.counters[E.id] == 0)) {
+                outs() << "  br_" << E.id << ": " << E.file_name << ", " << E.condition_line << ", " << E.block_start_line << "\n";
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,133 @@
+// Expands the path stream a program recorded in path mode
+// (-keypoints-mode=path) back into the branch trace trace mode would have
+// written.
+#include "Paths.h"
+#include "Ring.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+#include <cstring>
+
+using namespace llvm;
+using namespace keypoints;
+
+static cl::OptionCategory Category("keypoints-paths options");
+
+static cl::opt<std::string> StreamPath(cl::Positional, cl::desc("<branch_paths.pid.bin>"), cl::Required, cl::cat(Category));
+static cl::opt<std::string> TablePath("table", cl::desc("Path table written by the program, by default the stream's .txt"), cl::value_desc("path"), cl::cat(Category));
+static cl::opt<std::string> Output("o", cl::desc("Write the trace here instead of stdout"), cl::value_desc("path"), cl::init("-"), cl::cat(Category));
+static cl::opt<bool> Summary("summary", cl::desc("Print how well the paths compressed the trace instead of the trace"), cl::cat(Category));
+
+int main(int argc, char **argv) {
+    cl::HideUnrelatedOptions(Category);
+    cl::ParseCommandLineOptions(argc, argv, "KeyPoints path stream decoder\n");
+
+    if (TablePath.empty()) {
+        StringRef stem(StreamPath);
+        stem.consume_back(".bin");
+        TablePath = (stem + ".txt").str();
+    }
+    PathTable table;
+    std::string error;
+    if (!table.load(TablePath, error)) {
+        errs() << TablePath << ": " << error << "\n";
+        return 1;
+    }
+    auto file = MemoryBuffer::getFile(StreamPath, /*IsText=*/false, /*RequiresNullTerminator=*/false);
+    if (!file) {
+        errs() << StreamPath << ": " << file.getError().message() << "\n";
+        return 1;
+    }
+    auto &buffer = **file;
+    if (buffer.getBufferSize() < sizeof(PathMagic) || memcmp(buffer.getBufferStart(), PathMagic, sizeof(PathMagic)) != 0) {
+        errs() << StreamPath << ": not a path stream\n";
+        return 1;
+    }
+
+    std::error_code ec;
+    raw_fd_ostream out(Output, ec);
+    if (ec) {
+        errs() << Output << ": " << ec.message() << "\n";
+        return 1;
+    }
+    auto pos = buffer.getBufferStart() + sizeof(PathMagic);
+    auto end = buffer.getBufferEnd();
+    // the records are unaligned after a function pointer or literal
+    auto read32 = [&](uint32_t &value) {
+        if (end - pos < (ptrdiff_t)sizeof(value)) {
+            return false;
+        }
+        memcpy(&value, pos, sizeof(value));
+        pos += sizeof(value);
+        return true;
+    };
+    uint64_t records = 0, literals = 0, pointers = 0, events = 0;
+    bool truncated = false;
+    uint32_t record;
+    while (read32(record)) {
+        records++;
+        if (record == PathFunctionPointer) {
+            uint64_t event;
+            if (end - pos < (ptrdiff_t)sizeof(event)) {
+                truncated = true;
+                break;
+            }
+            memcpy(&event, pos, sizeof(event));
+            pos += sizeof(event);
+            pointers++;
+            events++;
+            if (!Summary) {
+                out << formatRingEvent(event) << "\n";
+            }
+            continue;
+        }
+        if (record == PathLiteral) {
+            uint32_t count, tag;
+            if (!read32(count)) {
+                truncated = true;
+                break;
+            }
+            literals++;
+            for (uint32_t i = 0; i < count; i++) {
+                if (!read32(tag)) {
+                    truncated = true;
+                    break;
+                }
+                events++;
+                if (!Summary) {
+                    out << "br_" << tag << "\n";
+                }
+            }
+            continue;
+        }
+        auto path = table.lookup(record);
+        if (!path) {
+            errs() << StreamPath << ": path " << record << " is not in " << TablePath << "\n";
+            return 1;
+        }
+        events += path->tags.size();
+        if (!Summary) {
+            for (auto tag : path->tags) {
+                out << "br_" << tag << "\n";
+            }
+        }
+    }
+    if (truncated || pos != end) {
+        // e.g. the program was killed before it could flush the stream
+        errs() << StreamPath << ": stream ends mid-record\n";
+    }
+    if (Summary) {
+        out << "events:            " << events << "\n";
+        out << "records:           " << records << "\n";
+        out << "distinct paths:    " << table.size() << "\n";
+        out << "literal segments:  " << literals << "\n";
+        out << "function pointers: " << pointers << "\n";
+        out << "stream bytes:      " << buffer.getBufferSize() << "\n";
+        if (events > 0) {
+            out << "bytes per event:   " << format("%.3f", (double)buffer.getBufferSize() / events) << "\n";
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,75 @@
+// Extracts the events a program recorded in ring mode (KEYPOINTS_RING) as a
+// branch trace, e.g. the last events before a crash.
+#include "Ring.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+#include <csignal>
+#include <cstring>
+
+using namespace llvm;
+using namespace keypoints;
+
+static cl::OptionCategory Category("keypoints-ring options");
+
+static cl::opt<std::string> RingPath(cl::Positional, cl::desc("<branch_trace.ring.pid>"), cl::Required, cl::cat(Category));
+static cl::opt<uint64_t> Last("last", cl::desc("Only print the newest N events, 0 for every event still in the ring"), cl::init(0), cl::cat(Category));
+static cl::opt<std::string> Output("o", cl::desc("Write the trace here instead of stdout"), cl::value_desc("path"), cl::init("-"), cl::cat(Category));
+
+int main(int argc, char **argv) {
+    cl::HideUnrelatedOptions(Category);
+    cl::ParseCommandLineOptions(argc, argv, "KeyPoints ring buffer recovery\n");
+
+    auto file = MemoryBuffer::getFile(RingPath, /*IsText=*/false, /*RequiresNullTerminator=*/false);
+    if (!file) {
+        errs() << RingPath << ": " << file.getError().message() << "\n";
+        return 1;
+    }
+    auto &buffer = **file;
+    auto header = reinterpret_cast<const RingHeader *>(buffer.getBufferStart());
+    if (buffer.getBufferSize() < sizeof(RingHeader) || memcmp(header->magic, RingMagic, sizeof(RingMagic)) != 0) {
+        errs() << RingPath << ": not a ring buffer\n";
+        return 1;
+    }
+    auto capacity = header->capacity;
+    if (capacity == 0 || (capacity & (capacity - 1)) != 0 ||
+        buffer.getBufferSize() < sizeof(RingHeader) + capacity * sizeof(RingSlot)) {
+        errs() << RingPath << ": corrupt ring header\n";
+        return 1;
+    }
+    auto slots = reinterpret_cast<const RingSlot *>(header + 1);
+
+    errs() << "pid " << header->pid << ": ";
+    switch (header->state) {
+    case RingExited: errs() << "exited normally"; break;
+    case RingSignaled: errs() << "killed by signal " << header->signal << " (" << strsignal(header->signal) << ")"; break;
+    default: errs() << "still running or died without a chance to seal the ring (e.g. SIGKILL)"; break;
+    }
+    auto head = header->head;
+    uint64_t first = head > capacity ? head - capacity : 0;
+    if (Last > 0 && head - first > Last) {
+        first = head - Last;
+    }
+    errs() << ", " << head << " events logged, " << (head - first) << " to extract\n";
+
+    std::error_code ec;
+    raw_fd_ostream out(Output, ec);
+    if (ec) {
+        errs() << Output << ": " << ec.message() << "\n";
+        return 1;
+    }
+    uint64_t missing = 0;
+    for (auto pos = first; pos < head; pos++) {
+        uint64_t event;
+        if (!readRingSlot(slots, capacity, pos, event)) {
+            // a write that was interrupted by the crash
+            missing++;
+            continue;
+        }
+        out << formatRingEvent(event) << "\n";
+    }
+    if (missing > 0) {
+        errs() << missing << " events were incomplete and skipped\n";
+    }
+    return 0;
+}
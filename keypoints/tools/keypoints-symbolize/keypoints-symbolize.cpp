@@ -0,0 +1,161 @@
+// Resolves the function pointer events in a trace to the function, file and
+// line they point at, using the object list the program wrote alongside it.
+#include "Trace.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/DebugInfo/Symbolize/Symbolize.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+using namespace llvm;
+using namespace keypoints;
+
+static cl::OptionCategory Category("keypoints-symbolize options");
+
+static cl::opt<std::string> TracePath(cl::Positional, cl::desc("<trace>"), cl::init("-"), cl::cat(Category));
+static cl::opt<std::string> ObjectsPath("objects", cl::desc("Object list written by the program, branch_objects.{pid}.txt"), cl::value_desc("path"), cl::Required, cl::cat(Category));
+static cl::opt<std::string> Output("o", cl::desc("Write the result here instead of stdout"), cl::value_desc("path"), cl::init("-"), cl::cat(Category));
+static cl::opt<bool> Summary("summary", cl::desc("Print how often each function was called through a pointer instead of the trace"), cl::cat(Category));
+
+namespace {
+
+struct Location {
+    std::string function;
+    std::string file;
+    uint32_t line = 0;
+    uint64_t calls = 0;
+};
+
+// Splits `func_0x{offset}` or `func_0x{offset}@{object}` into its parts.
+// Returns false for raw addresses (`@?`) and anything unparseable.
+bool parseEvent(const std::string &text, unsigned &object, uint64_t &offset) {
+    if (text.compare(0, 7, "func_0x") != 0) {
+        return false;
+    }
+    char *end = nullptr;
+    offset = strtoull(text.c_str() + 7, &end, 16);
+    if (end == text.c_str() + 7) {
+        return false;
+    }
+    object = 0;
+    if (*end == '@') {
+        char *number = end + 1;
+        object = strtoul(number, &end, 10);
+        if (end == number) {
+            return false;
+        }
+    }
+    return *end == '\0' || *end == ' ';
+}
+
+}
+
+int main(int argc, char **argv) {
+    cl::HideUnrelatedOptions(Category);
+    cl::ParseCommandLineOptions(argc, argv, "KeyPoints function pointer symbolizer\n");
+
+    std::ifstream objectsFile(ObjectsPath);
+    if (!objectsFile) {
+        errs() << ObjectsPath << ": unable to open\n";
+        return 1;
+    }
+    std::vector<std::string> objects;
+    std::string line;
+    while (std::getline(objectsFile, line)) {
+        std::istringstream fields(line);
+        unsigned number;
+        std::string bias, path;
+        if (!(fields >> number >> bias) || !std::getline(fields >> std::ws, path)) {
+            continue;
+        }
+        if (number >= objects.size()) {
+            objects.resize(number + 1);
+        }
+        objects[number] = path;
+    }
+
+    TraceReader reader;
+    if (!reader.open(TracePath)) {
+        errs() << TracePath << ": unable to open\n";
+        return 1;
+    }
+    std::error_code ec;
+    raw_fd_ostream out(Output, ec);
+    if (ec) {
+        errs() << Output << ": " << ec.message() << "\n";
+        return 1;
+    }
+
+    symbolize::LLVMSymbolizer::Options options;
+    options.PathStyle = DILineInfoSpecifier::FileLineInfoKind::RelativeFilePath;
+    symbolize::LLVMSymbolizer symbolizer(options);
+    // a trace usually calls a handful of functions millions of times, so each
+    // address is only looked up once
+    DenseMap<std::pair<unsigned, uint64_t>, unsigned> cache;
+    std::vector<Location> locations;
+    uint64_t unresolved = 0;
+    TraceEvent event;
+    while (reader.next(event)) {
+        unsigned object;
+        uint64_t offset;
+        if (event.kind != TraceEvent::FunctionPointer || !parseEvent(event.text, object, offset)) {
+            if (event.kind == TraceEvent::FunctionPointer) {
+                unresolved++;
+            }
+            if (!Summary) {
+                out << event.text << "\n";
+            }
+            continue;
+        }
+        auto inserted = cache.try_emplace({object, offset}, locations.size());
+        if (inserted.second) {
+            Location location;
+            if (object < objects.size() && !objects[object].empty()) {
+                auto info = symbolizer.symbolizeCode(objects[object], {offset, object::SectionedAddress::UndefSection});
+                if (info) {
+                    if (info->FunctionName != DILineInfo::BadString) {
+                        location.function = info->FunctionName;
+                    }
+                    if (info->FileName != DILineInfo::BadString) {
+                        location.file = info->FileName;
+                        location.line = info->Line;
+                    }
+                } else {
+                    consumeError(info.takeError());
+                }
+            }
+            locations.push_back(location);
+        }
+        auto &location = locations[inserted.first->second];
+        location.calls++;
+        if (location.function.empty()) {
+            unresolved++;
+        }
+        if (!Summary) {
+            out << event.text << " " << (location.function.empty() ? "??" : location.function);
+            if (!location.file.empty()) {
+                out << " " << location.file << ":" << location.line;
+            }
+            out << "\n";
+        }
+    }
+
+    if (Summary) {
+        std::sort(locations.begin(), locations.end(), [](const Location &a, const Location &b) { return a.calls > b.calls; });
+        for (auto &location : locations) {
+            out << format("%12llu  ", (unsigned long long)location.calls) << (location.function.empty() ? "??" : location.function);
+            if (!location.file.empty()) {
+                out << "  " << location.file << ":" << location.line;
+            }
+            out << "\n";
+        }
+    }
+    if (unresolved > 0) {
+        errs() << unresolved << " function pointer events couldn't be resolved\n";
+    }
+    return 0;
+}
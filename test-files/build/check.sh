@@ -0,0 +1,74 @@
+#!/bin/bash
+
+# Checks that keypoints-build can build every mode: each one is built from
+# ../simple/externalcall.c and externalfunc.c, once with --mode and once with
+# the mode passed through as -mllvm -keypoints-mode, then run, and the files it
+# writes are compared with what the mode should produce.
+#
+#   ./check.sh {path to keypoints-build} {path to KeyPointsPass.so}
+
+if [[ -z "$(which clang-15)" ]]; then
+    echo "Please install clang-15."
+    exit 1
+fi
+
+if [[ -z "$2" ]]; then
+    echo "usage: $0 {path to keypoints-build} {path to KeyPointsPass.so}"
+    exit 1
+fi
+
+BUILD=$(realpath "$1")
+PLUGIN=$(realpath "$2")
+SCRIPT_DIR=$(realpath "$(dirname "$0")")
+SOURCES="$SCRIPT_DIR/../simple/externalcall.c $SCRIPT_DIR/../simple/externalfunc.c"
+RUNTIME="$SCRIPT_DIR/../../keypoints/support/branchlog.c"
+
+# expected {mode}: the file the run should leave
+expected() {
+    case $1 in
+        trace) echo "branch_trace.txt" ;;
+        counter) echo "branch_counters.*.bin" ;;
+        timing) echo "branch_timing.*.txt" ;;
+        path) echo "branch_paths.*.bin" ;;
+    esac
+}
+
+pid=$$
+tmpdir="tmp-$pid"
+mkdir "$tmpdir"
+cd "$tmpdir"
+
+failed=0
+for mode in trace counter timing path; do
+    for style in option mllvm; do
+        rm -rf run
+        mkdir run
+        if [[ "$style" == option ]]; then
+            flags="--mode=$mode"
+        else
+            flags="-mllvm -keypoints-mode=$mode"
+        fi
+        # -pthread for the path mode runtime on older glibc
+        if ! (cd run && "$BUILD" --plugin="$PLUGIN" --runtime="$RUNTIME" $flags -O2 -pthread $SOURCES -o prog > ../build.log 2>&1); then
+            echo "FAIL $mode ($style): build failed"
+            cat build.log
+            failed=1
+            continue
+        fi
+        (cd run && ./prog > /dev/null)
+        written=$(cd run && ls $(expected "$mode") 2> /dev/null)
+        if [[ -z "$written" || ! -s run/branch_dictionary.txt ]]; then
+            echo "FAIL $mode ($style): no $(expected "$mode") or dictionary"
+            failed=1
+        elif [[ "$mode" != trace && -e run/branch_trace.txt ]]; then
+            echo "FAIL $mode ($style): wrote branch_trace.txt"
+            failed=1
+        else
+            echo "ok   $mode ($style)"
+        fi
+    done
+done
+
+cd ..
+rm -rf "$tmpdir"
+exit $failed
@@ -0,0 +1,49 @@
+#!/bin/bash
+
+# Checks that every loop in these files that vectorizes without instrumentation
+# still vectorizes when instrumented. Any extra arguments are passed to the
+# instrumented compile, by default the vectorization friendly counter options.
+#
+#   ./check.sh {path to KeyPointsPass.so} [plugin options...]
+
+if [[ -z "$(which clang-15)" ]]; then
+    echo "Please install clang-15."
+    exit 1
+fi
+
+if [[ -z "$1" ]]; then
+    echo "usage: $0 {path to KeyPointsPass.so} [plugin options...]"
+    exit 1
+fi
+
+PLUGIN=$(realpath "$1")
+OPTIONS=${@:2}
+if [[ -z "$OPTIONS" ]]; then
+    OPTIONS="-keypoints-mode=counter -keypoints-branchless -keypoints-promote-counters"
+fi
+
+MLLVM=""
+for o in $OPTIONS; do
+    MLLVM="$MLLVM -mllvm $o"
+done
+
+pid=$$
+tmpdir="tmp-$pid"
+mkdir "$tmpdir"
+cd "$tmpdir"
+
+failed=0
+for f in ../*.c; do
+    expected=$(clang-15 -O2 -c -Rpass=loop-vectorize "$f" -o /dev/null 2>&1 | grep -c "vectorized loop")
+    actual=$(clang-15 -O2 -gdwarf-4 -c -Rpass=loop-vectorize -Xclang -load -Xclang "$PLUGIN" -fpass-plugin="$PLUGIN" $MLLVM "$f" -o /dev/null 2>&1 | grep -c "vectorized loop")
+    if [[ "$actual" -lt "$expected" ]]; then
+        echo "FAIL $(basename "$f"): $actual of $expected loops vectorized"
+        failed=1
+    else
+        echo "ok   $(basename "$f"): $actual of $expected loops vectorized"
+    fi
+done
+
+cd ..
+rm -rf "$tmpdir"
+exit $failed
@@ -0,0 +1,26 @@
+#include <stdio.h>
+
+#define N 4096
+
+int in[N];
+int out[N];
+
+void clamp(int *restrict in, int *restrict out, int n, int lo, int hi) {
+    for (int i = 0; i < n; i++) {
+        int v = in[i];
+        if (v < lo) {
+            v = lo;
+        } else if (v > hi) {
+            v = hi;
+        }
+        out[i] = v;
+    }
+}
+
+int main() {
+    for (int i = 0; i < N; i++) {
+        in[i] = (i * 37) % 200 - 100;
+    }
+    clamp(in, out, N, -50, 50);
+    printf("%d %d\n", out[0], out[N - 1]);
+}
@@ -0,0 +1,22 @@
+#include <stdio.h>
+
+#define N 4096
+
+char text[N];
+
+int countmatch(char *restrict s, int n, char c) {
+    int count = 0;
+    for (int i = 0; i < n; i++) {
+        if (s[i] == c) {
+            count++;
+        }
+    }
+    return count;
+}
+
+int main() {
+    for (int i = 0; i < N; i++) {
+        text[i] = 'a' + i % 26;
+    }
+    printf("%d\n", countmatch(text, N, 'e'));
+}
@@ -0,0 +1,21 @@
+#include <stdio.h>
+
+#define N 4096
+
+float x[N];
+float y[N];
+
+void saxpy(float a, float *restrict x, float *restrict y, int n) {
+    for (int i = 0; i < n; i++) {
+        y[i] = a * x[i] + y[i];
+    }
+}
+
+int main() {
+    for (int i = 0; i < N; i++) {
+        x[i] = i;
+        y[i] = N - i;
+    }
+    saxpy(2.0f, x, y, N);
+    printf("%f\n", y[N - 1]);
+}
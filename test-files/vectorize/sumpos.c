@@ -0,0 +1,22 @@
+#include <stdio.h>
+
+#define N 4096
+
+int a[N];
+
+int sumpos(int *restrict p, int n) {
+    int s = 0;
+    for (int i = 0; i < n; i++) {
+        if (p[i] > 0) {
+            s += p[i];
+        }
+    }
+    return s;
+}
+
+int main() {
+    for (int i = 0; i < N; i++) {
+        a[i] = (i % 7) - 3;
+    }
+    printf("%d\n", sumpos(a, N));
+}